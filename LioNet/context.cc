@@ -0,0 +1,126 @@
+#include "context.h"
+#include <stdint.h>
+#include <string.h>
+
+#ifdef LIONET_HAS_FCONTEXT
+
+// 切换时栈上的保存布局（低地址 -> 高地址）：
+//   x86-64:  mxcsr/x87cw, r12, r13, r14, r15, rbx, rbp, 返回地址
+//   aarch64: d8-d15, x19-x28, x29(fp), x30(lr)
+// 新上下文的“返回地址”指向 trampoline，由它以 ABI 对齐的栈调用入口函数
+#if defined(__x86_64__)
+
+asm(R"(
+.pushsection .text
+.globl lionet_swap_fcontext
+.type lionet_swap_fcontext,@function
+.align 16
+lionet_swap_fcontext:
+    pushq %rbp
+    pushq %rbx
+    pushq %r15
+    pushq %r14
+    pushq %r13
+    pushq %r12
+    leaq -0x8(%rsp), %rsp
+    stmxcsr (%rsp)
+    fnstcw 0x4(%rsp)
+    movq %rsp, (%rdi)
+    movq %rsi, %rsp
+    ldmxcsr (%rsp)
+    fldcw 0x4(%rsp)
+    leaq 0x8(%rsp), %rsp
+    popq %r12
+    popq %r13
+    popq %r14
+    popq %r15
+    popq %rbx
+    popq %rbp
+    ret
+.size lionet_swap_fcontext,.-lionet_swap_fcontext
+
+.hidden lionet_fcontext_trampoline
+.type lionet_fcontext_trampoline,@function
+.align 16
+lionet_fcontext_trampoline:
+    callq *%r12
+    ud2
+.size lionet_fcontext_trampoline,.-lionet_fcontext_trampoline
+.popsection
+)");
+
+#elif defined(__aarch64__)
+
+asm(R"(
+.pushsection .text
+.globl lionet_swap_fcontext
+.type lionet_swap_fcontext,%function
+.align 4
+lionet_swap_fcontext:
+    sub sp, sp, #0xa0
+    stp d8, d9, [sp, #0x00]
+    stp d10, d11, [sp, #0x10]
+    stp d12, d13, [sp, #0x20]
+    stp d14, d15, [sp, #0x30]
+    stp x19, x20, [sp, #0x40]
+    stp x21, x22, [sp, #0x50]
+    stp x23, x24, [sp, #0x60]
+    stp x25, x26, [sp, #0x70]
+    stp x27, x28, [sp, #0x80]
+    stp x29, x30, [sp, #0x90]
+    mov x9, sp
+    str x9, [x0]
+    mov sp, x1
+    ldp d8, d9, [sp, #0x00]
+    ldp d10, d11, [sp, #0x10]
+    ldp d12, d13, [sp, #0x20]
+    ldp d14, d15, [sp, #0x30]
+    ldp x19, x20, [sp, #0x40]
+    ldp x21, x22, [sp, #0x50]
+    ldp x23, x24, [sp, #0x60]
+    ldp x25, x26, [sp, #0x70]
+    ldp x27, x28, [sp, #0x80]
+    ldp x29, x30, [sp, #0x90]
+    add sp, sp, #0xa0
+    ret
+.size lionet_swap_fcontext,.-lionet_swap_fcontext
+
+.hidden lionet_fcontext_trampoline
+.type lionet_fcontext_trampoline,%function
+.align 4
+lionet_fcontext_trampoline:
+    blr x19
+    brk #0
+.size lionet_fcontext_trampoline,.-lionet_fcontext_trampoline
+.popsection
+)");
+
+#endif
+
+extern "C" void lionet_fcontext_trampoline();
+
+namespace LioNet {
+
+fcontext_t MakeFcontext(void* stack, size_t size, void (*fn)()) {
+  uintptr_t top = ((uintptr_t)stack + size) & ~(uintptr_t)15;
+#if defined(__x86_64__)
+  // 预留 16 字节，保证 ret 到 trampoline 后 rsp 16 字节对齐
+  uint64_t* sp = (uint64_t*)(top - 80);
+  memset(sp, 0, 80);
+  uint32_t* fpu = (uint32_t*)sp;
+  fpu[0] = 0x1F80;  // mxcsr 默认值
+  fpu[1] = 0x037F;  // x87 控制字默认值
+  sp[1] = (uint64_t)fn;                          // r12
+  sp[7] = (uint64_t)&lionet_fcontext_trampoline;  // 返回地址
+#else
+  uint64_t* sp = (uint64_t*)(top - 0xa0);
+  memset(sp, 0, 0xa0);
+  sp[8] = (uint64_t)fn;                           // x19
+  sp[19] = (uint64_t)&lionet_fcontext_trampoline;  // x30
+#endif
+  return sp;
+}
+
+}  // namespace LioNet
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * @file context.h
+ * @brief 协程上下文切换封装
+ * @details x86-64/aarch64 下使用汇编实现的 fcontext 切换，只保存被调用者保存寄存器，
+ *          不像 glibc 的 swapcontext 那样每次都通过 rt_sigprocmask 系统调用保存信号掩码。
+ *          定义 LIONET_FIBER_UCONTEXT 时 Fiber 回退到 ucontext 实现。
+ */
+
+#ifndef __LIONET_CONTEXT_H__
+#define __LIONET_CONTEXT_H__
+
+#include <stddef.h>
+
+#if defined(__x86_64__) || defined(__aarch64__)
+#define LIONET_HAS_FCONTEXT 1
+#endif
+
+// 不支持汇编切换的平台只能使用 ucontext
+#if !defined(LIONET_HAS_FCONTEXT) && !defined(LIONET_FIBER_UCONTEXT)
+#define LIONET_FIBER_UCONTEXT 1
+#endif
+
+namespace LioNet {
+
+/// 挂起上下文的句柄，即保存完寄存器后的栈顶指针
+typedef void* fcontext_t;
+
+#ifdef LIONET_HAS_FCONTEXT
+
+extern "C" void lionet_swap_fcontext(fcontext_t* from, fcontext_t to);
+
+/**
+ * @brief 保存当前上下文到 *from，并切换到上下文 to
+ * @param[out] from 保存当前上下文
+ * @param[in] to 目标上下文
+ */
+inline void SwapFcontext(fcontext_t* from, fcontext_t to) {
+  lionet_swap_fcontext(from, to);
+}
+
+/**
+ * @brief 在栈 [stack, stack + size) 上构造上下文
+ * @param[in] stack 栈低地址
+ * @param[in] size 栈大小
+ * @param[in] fn 上下文入口函数（不允许返回）
+ * @return 可以传给 SwapFcontext 的上下文
+ */
+fcontext_t MakeFcontext(void* stack, size_t size, void (*fn)());
+
+#endif
+
+}  // namespace LioNet
+
+#endif
@@ -0,0 +1,203 @@
+#include "cpu_topology.h"
+#include <dirent.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+
+namespace LioNet {
+
+static const char* kCpuRoot = "/sys/devices/system/cpu/cpu";
+static const char* kNodeRoot = "/sys/devices/system/node";
+
+/**
+ * @brief 读取 sysfs 文件的第一行，不存在返回空串
+ */
+static std::string ReadLine(const std::string& path) {
+  std::ifstream ifs(path);
+  std::string line;
+  if (ifs) {
+    std::getline(ifs, line);
+  }
+  return line;
+}
+
+static int ReadInt(const std::string& path, int def) {
+  std::string line = ReadLine(path);
+  return line.empty() ? def : atoi(line.c_str());
+}
+
+/**
+ * @brief 解析 "0-3,8,10-11" 格式的 CPU 列表
+ */
+static std::vector<int> ParseCpuList(const std::string& str) {
+  std::vector<int> cpus;
+  std::stringstream ss(str);
+  std::string item;
+  while (std::getline(ss, item, ',')) {
+    if (item.empty()) {
+      continue;
+    }
+    size_t dash = item.find('-');
+    int first = atoi(item.c_str());
+    int last = dash == std::string::npos ? first : atoi(item.c_str() + dash + 1);
+    for (int i = first; i <= last; ++i) {
+      cpus.push_back(i);
+    }
+  }
+  return cpus;
+}
+
+/**
+ * @brief 返回与 cpu 共享 L3 缓存的 CPU 列表，没有 L3 信息返回空串
+ */
+static std::string ReadL3Shared(int cpu) {
+  std::string base = kCpuRoot + std::to_string(cpu) + "/cache/index";
+  for (int i = 0; i < 8; ++i) {
+    std::string index = base + std::to_string(i);
+    int level = ReadInt(index + "/level", -1);
+    if (level == -1) {
+      break;
+    }
+    if (level == 3) {
+      return ReadLine(index + "/shared_cpu_list");
+    }
+  }
+  return "";
+}
+
+CpuTopology::CpuTopology() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  if (sched_getaffinity(0, sizeof(allowed), &allowed)) {
+    CPU_ZERO(&allowed);
+    CPU_SET(0, &allowed);
+  }
+
+  std::map<int, int> cpu_node;
+  DIR* dir = opendir(kNodeRoot);
+  if (dir) {
+    while (struct dirent* ent = readdir(dir)) {
+      if (strncmp(ent->d_name, "node", 4) != 0 || ent->d_name[4] < '0' ||
+          ent->d_name[4] > '9') {
+        continue;
+      }
+      int node = atoi(ent->d_name + 4);
+      std::string list = ReadLine(std::string(kNodeRoot) + "/" + ent->d_name +
+                                  "/cpulist");
+      for (int cpu : ParseCpuList(list)) {
+        cpu_node[cpu] = node;
+      }
+    }
+    closedir(dir);
+  }
+
+  // L3 域以共享列表（没有时以插槽）为键，按首次出现的顺序编号
+  std::map<std::string, int> l3_ids;
+  std::set<int> nodes;
+  for (int i = 0; i < CPU_SETSIZE; ++i) {
+    if (!CPU_ISSET(i, &allowed)) {
+      continue;
+    }
+    std::string topo = kCpuRoot + std::to_string(i) + "/topology/";
+    Cpu cpu;
+    cpu.id = i;
+    cpu.core = ReadInt(topo + "core_id", i);
+    cpu.package = ReadInt(topo + "physical_package_id", 0);
+    std::string shared = ReadL3Shared(i);
+    std::string key =
+        shared.empty() ? "package" + std::to_string(cpu.package) : shared;
+    auto it = l3_ids.find(key);
+    if (it == l3_ids.end()) {
+      it = l3_ids.insert(std::make_pair(key, (int)l3_ids.size())).first;
+    }
+    cpu.l3 = it->second;
+    auto nit = cpu_node.find(i);
+    cpu.node = nit == cpu_node.end() ? 0 : nit->second;
+    nodes.insert(cpu.node);
+    m_cpus.push_back(cpu);
+  }
+  std::sort(m_cpus.begin(), m_cpus.end(), [](const Cpu& a, const Cpu& b) {
+    if (a.node != b.node) {
+      return a.node < b.node;
+    }
+    if (a.l3 != b.l3) {
+      return a.l3 < b.l3;
+    }
+    if (a.package != b.package) {
+      return a.package < b.package;
+    }
+    if (a.core != b.core) {
+      return a.core < b.core;
+    }
+    return a.id < b.id;
+  });
+  m_l3Count = l3_ids.size();
+  m_nodeCount = nodes.size();
+}
+
+const CpuTopology::Cpu* CpuTopology::find(int cpu) const {
+  for (auto& i : m_cpus) {
+    if (i.id == cpu) {
+      return &i;
+    }
+  }
+  return nullptr;
+}
+
+int CpuTopology::getL3(const std::vector<int>& cpus) const {
+  int l3 = -1;
+  for (int id : cpus) {
+    const Cpu* cpu = find(id);
+    if (!cpu || (l3 != -1 && cpu->l3 != l3)) {
+      return -1;
+    }
+    l3 = cpu->l3;
+  }
+  return l3;
+}
+
+int CpuTopology::getNode(const std::vector<int>& cpus) const {
+  int node = -1;
+  for (int id : cpus) {
+    const Cpu* cpu = find(id);
+    if (!cpu || (node != -1 && cpu->node != node)) {
+      return -1;
+    }
+    node = cpu->node;
+  }
+  return node;
+}
+
+std::vector<int> CpuTopology::getL3Cpus(int l3) const {
+  std::vector<int> cpus;
+  for (auto& i : m_cpus) {
+    if (i.l3 == l3) {
+      cpus.push_back(i.id);
+    }
+  }
+  return cpus;
+}
+
+std::string CpuTopology::toString() const {
+  std::stringstream ss;
+  ss << "[CpuTopology cpus=" << m_cpus.size() << " l3=" << m_l3Count
+     << " nodes=" << m_nodeCount << "]";
+  for (auto& i : m_cpus) {
+    ss << std::endl
+       << "    cpu=" << i.id << " core=" << i.core << " package=" << i.package
+       << " l3=" << i.l3 << " node=" << i.node;
+  }
+  return ss.str();
+}
+
+const CpuTopology* CpuTopology::GetInstance() {
+  static CpuTopology s_instance;
+  return &s_instance;
+}
+
+}  // namespace LioNet
@@ -0,0 +1,93 @@
+/**
+ * @file cpu_topology.h
+ * @brief CPU 拓扑（核、L3 缓存域、NUMA 节点）
+ */
+
+#ifndef __LIONET_CPU_TOPOLOGY_H__
+#define __LIONET_CPU_TOPOLOGY_H__
+
+#include <string>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace LioNet {
+
+/**
+ * @brief CPU 拓扑
+ * @details 启动时从 /sys/devices/system 读取进程可用的 CPU 及其所属的物理核、
+ *          L3 缓存域和 NUMA 节点。读取不到的信息退化为：L3 域按物理 CPU 插槽划分，
+ *          NUMA 节点为 0。L3 域编号重新映射为从 0 开始的连续整数，
+ *          NUMA 节点保持系统的编号，可以直接用于 mbind
+ */
+class CpuTopology : Noncopyable {
+ public:
+  /**
+   * @brief 一个逻辑 CPU
+   */
+  struct Cpu {
+    int id;       // 逻辑 CPU 编号
+    int core;     // 物理核编号（插槽内）
+    int package;  // 物理 CPU 插槽
+    int l3;       // L3 缓存域
+    int node;     // NUMA 节点
+  };
+
+  /**
+   * @brief 返回进程可用的 CPU，按 (节点, L3 域, 插槽, 核, 编号) 排序，
+   *        同一个核的超线程相邻
+   */
+  const std::vector<Cpu>& getCpus() const { return m_cpus; }
+
+  /**
+   * @brief 返回 L3 缓存域的个数
+   */
+  int getL3Count() const { return m_l3Count; }
+
+  /**
+   * @brief 返回 NUMA 节点的个数
+   */
+  int getNodeCount() const { return m_nodeCount; }
+
+  /**
+   * @brief 返回 CPU 信息，不可用的 CPU 返回 nullptr
+   */
+  const Cpu* find(int cpu) const;
+
+  /**
+   * @brief 返回 CPU 集合所在的 L3 域，跨多个域或为空返回 -1
+   */
+  int getL3(const std::vector<int>& cpus) const;
+
+  /**
+   * @brief 返回 CPU 集合所在的 NUMA 节点，跨多个节点或为空返回 -1
+   */
+  int getNode(const std::vector<int>& cpus) const;
+
+  /**
+   * @brief 返回 L3 域内的 CPU
+   */
+  std::vector<int> getL3Cpus(int l3) const;
+
+  /**
+   * @brief 输出拓扑
+   */
+  std::string toString() const;
+
+  /**
+   * @brief 返回单例
+   */
+  static const CpuTopology* GetInstance();
+
+ private:
+  CpuTopology();
+
+ private:
+  std::vector<Cpu> m_cpus;  // 可用的 CPU
+  int m_l3Count = 0;        // L3 缓存域个数
+  int m_nodeCount = 0;      // NUMA 节点个数
+};
+
+}  // namespace LioNet
+
+#endif
@@ -1,9 +1,18 @@
 #include "fiber.h"
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <algorithm>
 #include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
 #include "config.h"
 #include "log.h"
 #include "macro.h"
 #include "scheduler.h"
+#include "stack_allocator.h"
+#include "util.h"
 
 namespace LioNet {
 
@@ -29,17 +38,205 @@ static thread_local Fiber::ptr t_threadFiber = nullptr;  // 指向主协程
 static ConfigVar<uint32_t>::ptr g_fiber_stack_size = Config::Lookup<uint32_t>(
     "fiber.stack_size", 128 * 1024, "fiber stack size");
 
-class MallocStackAllocator {
- public:
-  static void* Alloc(size_t size) { return malloc(size); }
+static ConfigVar<uint32_t>::ptr g_shared_stack_size = Config::Lookup<uint32_t>(
+    "fiber.shared_stack.size", 1024 * 1024, "fiber shared stack size");
+
+static ConfigVar<uint32_t>::ptr g_shared_stack_count =
+    Config::Lookup<uint32_t>("fiber.shared_stack.count", 4,
+                             "fiber shared stacks per thread");
+
+// 创建协程时不再每次加锁读取配置
+static std::atomic<uint32_t> s_fiber_stack_size{128 * 1024};
+static std::atomic<uint32_t> s_shared_stack_size{1024 * 1024};
+static std::atomic<uint32_t> s_shared_stack_count{4};
+
+struct FiberIniter {
+  FiberIniter() {
+    s_fiber_stack_size = g_fiber_stack_size->getValue();
+    s_shared_stack_size = g_shared_stack_size->getValue();
+    s_shared_stack_count = g_shared_stack_count->getValue();
+    g_fiber_stack_size->addListener(
+        [](const uint32_t&, const uint32_t& new_value) {
+          s_fiber_stack_size = new_value;
+        });
+    g_shared_stack_size->addListener(
+        [](const uint32_t&, const uint32_t& new_value) {
+          s_shared_stack_size = new_value;
+        });
+    g_shared_stack_count->addListener(
+        [](const uint32_t&, const uint32_t& new_value) {
+          s_shared_stack_count = new_value;
+        });
+  }
+};
+
+static FiberIniter __fiber_init;
+
+// 协程局部存储槽位上限，析构函数表固定大小，读取时不需要加锁
+static const size_t kMaxFiberLocals = 1024;
+static std::atomic<size_t> s_local_count{0};
+static void (*s_local_dtors[kMaxFiberLocals])(void*);
+
+static ConfigVar<bool>::ptr g_fiber_overflow_handler = Config::Lookup<bool>(
+    "fiber.overflow_handler", true,
+    "report fiber stack overflow from a SIGSEGV handler");
+
+// 信号处理函数运行在备用栈上，需要足够空间格式化日志和回溯调用栈
+static const size_t kSignalStackSize = 64 * 1024;
 
-  static void Dealloc(void* vp, size_t size) {
-    free(vp);
+static struct sigaction s_old_segv_action;
+
+// 判断 SIGSEGV 是否由当前协程触碰栈保护页导致，不是则交给原来的处理方式
+static void FiberSegvHandler(int sig, siginfo_t* info, void* uctx) {
+  Fiber* cur = t_fiber;
+  if (cur && cur->isGuardAddress(info->si_addr)) {
+    LIONET_LOG_STACK(g_logger, LioNet::LogLevel::FATAL, 64, "    ")
+        << "Fiber stack overflow, fiber_id=" << cur->getId()
+        << " stack_size=" << cur->getStackSize()
+        << " fault_addr=" << info->si_addr << std::endl;
+    signal(SIGABRT, SIG_DFL);
+    abort();
+  }
+
+  if (s_old_segv_action.sa_flags & SA_SIGINFO) {
+    s_old_segv_action.sa_sigaction(sig, info, uctx);
+    return;
+  }
+  if (s_old_segv_action.sa_handler != SIG_DFL &&
+      s_old_segv_action.sa_handler != SIG_IGN) {
+    s_old_segv_action.sa_handler(sig);
     return;
   }
+  // 恢复默认处理，返回后重新执行出错指令并以 SIGSEGV 结束进程
+  sigaction(SIGSEGV, &s_old_segv_action, nullptr);
+}
+
+namespace {
+/**
+ * @brief 线程的备用信号栈，线程退出时释放
+ */
+struct SignalStack {
+  void* stack = nullptr;
+
+  ~SignalStack() {
+    if (!stack) {
+      return;
+    }
+    stack_t ss;
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_flags = SS_DISABLE;
+    sigaltstack(&ss, nullptr);
+    munmap(stack, kSignalStackSize);
+  }
 };
+}  // namespace
+
+static thread_local SignalStack t_signal_stack;
+
+// 线程第一次创建主协程时调用：进程内安装一次 SIGSEGV 处理函数，本线程安装备用信号栈
+static void InstallOverflowHandler() {
+  if (!g_fiber_overflow_handler->getValue()) {
+    return;
+  }
+
+  static std::once_flag s_once;
+  std::call_once(s_once, [] {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_sigaction = &FiberSegvHandler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGSEGV, &sa, &s_old_segv_action)) {
+      LIONET_ERROR(g_logger) << "sigaction SIGSEGV fail, errno=" << errno;
+    }
+  });
+
+  stack_t old;
+  if (sigaltstack(nullptr, &old) == 0 && !(old.ss_flags & SS_DISABLE)) {
+    return;  // 线程已经有备用信号栈
+  }
+  void* vp = mmap(nullptr, kSignalStackSize, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (vp == MAP_FAILED) {
+    LIONET_ERROR(g_logger) << "mmap signal stack fail, errno=" << errno;
+    return;
+  }
+  stack_t ss;
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_sp = vp;
+  ss.ss_size = kSignalStackSize;
+  if (sigaltstack(&ss, nullptr)) {
+    LIONET_ERROR(g_logger) << "sigaltstack fail, errno=" << errno;
+    munmap(vp, kSignalStackSize);
+    return;
+  }
+  t_signal_stack.stack = vp;
+}
+
+namespace {
+/**
+ * @brief 线程内的一块共享运行栈
+ */
+struct SharedStack {
+  char* base = nullptr;                 // 栈低地址
+  size_t size = 0;                      // 栈大小
+  StackAllocator* allocator = nullptr;  // 栈分配器
+  Fiber* occupant = nullptr;            // 栈上当前内容所属的协程
+  int thread = -1;                      // 所属线程id
+
+  char* top() const { return base + size; }
+};
+
+/**
+ * @brief 线程私有的共享栈组，协程第一次运行时轮流绑定
+ */
+struct SharedStackGroup {
+  std::vector<SharedStack> stacks;
+  size_t next = 0;
+
+  SharedStack* acquire() {
+    if (stacks.empty()) {
+      stacks.resize(std::max<uint32_t>(1, s_shared_stack_count));
+      int thread = LioNet::GetThreadId();
+      for (auto& i : stacks) {
+        i.size = s_shared_stack_size;
+        i.allocator = StackAllocator::GetDefault();
+        i.base = (char*)i.allocator->alloc(i.size);
+        i.thread = thread;
+      }
+    }
+    SharedStack* stack = &stacks[next];
+    next = (next + 1) % stacks.size();
+    return stack;
+  }
+
+  bool owns(const SharedStack* stack) const {
+    return !stacks.empty() && stack >= &stacks.front() &&
+           stack <= &stacks.back();
+  }
+
+  ~SharedStackGroup() {
+    for (auto& i : stacks) {
+      i.allocator->dealloc(i.base, i.size);
+    }
+  }
+};
+}  // namespace
+
+static thread_local SharedStackGroup t_shared_stacks;
 
-using StackAllocator = MallocStackAllocator;
+/**
+ * @brief 共享栈模式下协程私有的状态
+ */
+struct Fiber::SharedStackContext {
+  SharedStack* stack = nullptr;  // 绑定的共享栈，第一次运行时绑定
+  char* buffer = nullptr;        // 被换出时保存栈内容的缓冲区
+  size_t size = 0;               // 保存的栈内容大小
+  size_t capacity = 0;           // 缓冲区容量
+  void (*entry)() = nullptr;     // 协程入口
+
+  ~SharedStackContext() { free(buffer); }
+};
 
 uint64_t Fiber::GetFiberId() {
   if (t_fiber) {
@@ -52,34 +249,41 @@ Fiber::Fiber() {
   m_state = EXEC;
   SetThis(this);
 
+#ifdef LIONET_FIBER_UCONTEXT
   if (getcontext(&m_ctx)) {
     LIONET_ASSERT2(false, "getcontext");
   }
+#endif
 
   m_id = ++s_fiber_id;
   ++s_fiber_count;
 
+  InstallOverflowHandler();
+
   LIONET_DEBUG(g_logger) << "Fiber::Fiber Main";
 }
 
-Fiber::Fiber(std::function<void()> func, size_t stacksize, bool use_caller)
-    : m_id(++s_fiber_id), m_func(func) {
+Fiber::Fiber(Task func, size_t stacksize, bool use_caller, bool shared_stack)
+    : m_id(++s_fiber_id), m_func(std::move(func)) {
   ++s_fiber_count;
-  m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
-
-  m_stack = StackAllocator::Alloc(m_stacksize);
-  if (getcontext(&m_ctx)) {
-    LIONET_ASSERT2(false, "getcontext");
-  }
-  m_ctx.uc_link = nullptr;
-  m_ctx.uc_stack.ss_sp = m_stack;
-  m_ctx.uc_stack.ss_size = m_stacksize;
 
   // 统一函数入口及后处理
-  if (!use_caller) {
-    makecontext(&m_ctx, &Fiber::MainFunc, 0);
-  } else {
-    makecontext(&m_ctx, &Fiber::CallerMainFunc, 0);
+  void (*entry)() = use_caller ? &Fiber::CallerMainFunc : &Fiber::MainFunc;
+#ifndef LIONET_FIBER_UCONTEXT
+  if (shared_stack) {
+    // 上下文在第一次切入、绑定共享栈之后再构造
+    m_shared = new SharedStackContext;
+    m_shared->entry = entry;
+    m_stacksize = s_shared_stack_size.load(std::memory_order_relaxed);
+  }
+#endif
+  if (!m_shared) {
+    m_stacksize = stacksize
+                      ? stacksize
+                      : s_fiber_stack_size.load(std::memory_order_relaxed);
+    m_allocator = StackAllocator::GetDefault();
+    m_stack = m_allocator->alloc(m_stacksize);
+    makeContext(entry);
   }
   m_state = INIT;
   LIONET_DEBUG(g_logger) << "Fiber::Fiber id=" << m_id;
@@ -87,9 +291,20 @@ Fiber::Fiber(std::function<void()> func, size_t stacksize, bool use_caller)
 
 Fiber::~Fiber() {
   --s_fiber_count;
-  if (m_stack) {  // 子协程析构
+  clearLocals();
+  delete m_localOverflow;
+  if (m_callbacks) {
+    complete();
+    delete m_callbacks;
+  }
+  if (m_stack || m_shared) {  // 子协程析构
     LIONET_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
-    StackAllocator::Dealloc(m_stack, m_stacksize);
+    if (m_shared) {
+      releaseSharedStack();
+      delete m_shared;
+    } else {
+      m_allocator->dealloc(m_stack, m_stacksize);
+    }
   } else {  // 主协程析构
     LIONET_ASSERT(!m_func);
     LIONET_ASSERT(m_state == EXEC);
@@ -103,51 +318,318 @@ Fiber::~Fiber() {
                          << ", total=" << s_fiber_count;
 }
 
-void Fiber::reset(std::function<void()> func) {
-  LIONET_ASSERT(m_stack);
+void Fiber::reset(Task func) {
+  LIONET_ASSERT(m_stack || m_shared);
   LIONET_ASSERT(m_state == TERM || m_state == EXCEPT || m_state == INIT);
 
-  m_func = func;
+  clearLocals();
+  {
+    Spinlock::Lock lock(m_completeMutex);
+    LIONET_ASSERT(!m_callbacks || m_callbacks->empty());
+    m_done = false;
+  }
+  m_func = std::move(func);
+  if (m_shared) {
+#ifndef LIONET_FIBER_UCONTEXT
+    releaseSharedStack();
+    m_shared->entry = &Fiber::MainFunc;
+    m_ctx = nullptr;
+#endif
+  } else {
+    makeContext(&Fiber::MainFunc);
+  }
+  m_state = INIT;
+}
+
+bool Fiber::isGuardAddress(const void* addr) const {
+  const char* low = (const char*)m_stack;
+  StackAllocator* allocator = m_allocator;
+  if (m_shared && m_shared->stack) {
+    low = m_shared->stack->base;
+    allocator = m_shared->stack->allocator;
+  }
+  if (!low || !allocator) {
+    return false;
+  }
+  size_t guard = allocator->guardSize();
+  return guard && (const char*)addr >= low - guard && (const char*)addr < low;
+}
+
+size_t Fiber::RegisterLocalSlot(void (*dtor)(void*)) {
+  size_t slot = s_local_count++;
+  LIONET_ASSERT2(slot < kMaxFiberLocals, "too many fiber local slots");
+  s_local_dtors[slot] = dtor;
+  return slot;
+}
+
+void* Fiber::getOverflowLocal(size_t slot) const {
+  size_t idx = slot - kInlineLocals;
+  if (m_localOverflow && idx < m_localOverflow->size()) {
+    return (*m_localOverflow)[idx];
+  }
+  return nullptr;
+}
+
+void Fiber::setLocal(size_t slot, void* value) {
+  void** p = nullptr;
+  if (slot < kInlineLocals) {
+    p = &m_locals[slot];
+  } else {
+    size_t idx = slot - kInlineLocals;
+    if (!m_localOverflow) {
+      m_localOverflow = new std::vector<void*>;
+    }
+    if (idx >= m_localOverflow->size()) {
+      m_localOverflow->resize(idx + 1, nullptr);
+    }
+    p = &(*m_localOverflow)[idx];
+  }
+  void* old = *p;
+  *p = value;
+  if (old && old != value) {
+    s_local_dtors[slot](old);
+  }
+}
+
+void Fiber::clearLocals() {
+  // 析构函数中可能再次设置其他槽位，重复几轮直到清空（与 pthread key 的处理一致）
+  for (int round = 0; round < 4; ++round) {
+    bool found = false;
+    for (size_t i = 0; i < kInlineLocals; ++i) {
+      if (m_locals[i]) {
+        void* vp = m_locals[i];
+        m_locals[i] = nullptr;
+        s_local_dtors[i](vp);
+        found = true;
+      }
+    }
+    if (m_localOverflow) {
+      for (size_t i = 0; i < m_localOverflow->size(); ++i) {
+        if ((*m_localOverflow)[i]) {
+          void* vp = (*m_localOverflow)[i];
+          (*m_localOverflow)[i] = nullptr;
+          s_local_dtors[i + kInlineLocals](vp);
+          found = true;
+        }
+      }
+    }
+    if (!found) {
+      return;
+    }
+  }
+}
+
+int Fiber::getBoundThread() const {
+  if (m_shared && m_shared->stack) {
+    return m_shared->stack->thread;
+  }
+  return -1;
+}
+
+void Fiber::prepareSharedStack() {
+#ifndef LIONET_FIBER_UCONTEXT
+  if (!m_shared->stack) {
+    m_shared->stack = t_shared_stacks.acquire();
+  }
+  SharedStack* stack = m_shared->stack;
+  LIONET_ASSERT2(t_shared_stacks.owns(stack),
+                 "shared stack fiber resumed on another thread, fiber_id=" +
+                     std::to_string(m_id));
+
+  if (stack->occupant != this) {
+    if (stack->occupant) {
+      stack->occupant->saveSharedStack();
+    }
+    stack->occupant = this;
+    if (m_ctx) {
+      memcpy(stack->top() - m_shared->size, m_shared->buffer, m_shared->size);
+    }
+  }
+  if (!m_ctx) {
+    m_ctx = MakeFcontext(stack->base, stack->size, m_shared->entry);
+  }
+#endif
+}
+
+void Fiber::saveSharedStack() {
+#ifndef LIONET_FIBER_UCONTEXT
+  size_t used = m_shared->stack->top() - (char*)m_ctx;
+  if (used > m_shared->capacity) {
+    free(m_shared->buffer);
+    m_shared->buffer = (char*)malloc(used);
+    m_shared->capacity = used;
+  }
+  memcpy(m_shared->buffer, m_ctx, used);
+  m_shared->size = used;
+#endif
+}
+
+void Fiber::releaseSharedStack() {
+  if (m_shared->stack && m_shared->stack->occupant == this) {
+    m_shared->stack->occupant = nullptr;
+  }
+  m_shared->size = 0;
+}
+
+void Fiber::makeContext(void (*fn)()) {
+#ifdef LIONET_FIBER_UCONTEXT
   if (getcontext(&m_ctx)) {
     LIONET_ASSERT2(false, "getcontext");
   }
-
   m_ctx.uc_link = nullptr;
   m_ctx.uc_stack.ss_sp = m_stack;
   m_ctx.uc_stack.ss_size = m_stacksize;
+  makecontext(&m_ctx, fn, 0);
+#else
+  m_ctx = MakeFcontext(m_stack, m_stacksize, fn);
+#endif
+}
 
-  makecontext(&m_ctx, &Fiber::MainFunc, 0);
-  m_state = INIT;
+void Fiber::SwitchContext(Fiber* from, Fiber* to) {
+#ifdef LIONET_FIBER_UCONTEXT
+  if (swapcontext(&from->m_ctx, &to->m_ctx)) {
+    LIONET_ASSERT2(false, "swapcontext");
+  }
+#else
+  if (to->m_shared) {
+    to->prepareSharedStack();
+  }
+  SwapFcontext(&from->m_ctx, to->m_ctx);
+#endif
+}
+
+const char* Fiber::ContextBackend() {
+#ifdef LIONET_FIBER_UCONTEXT
+  return "ucontext";
+#else
+  return "fcontext";
+#endif
+}
+
+// swapIn/swapOut 的对端：调度协程，线程没有调度器时退化为线程主协程
+static Fiber* GetSwapFiber() {
+  Fiber* f = Scheduler::GetMainFiber();
+  return f ? f : t_threadFiber.get();
 }
 
 void Fiber::call() {
   SetThis(this);
   m_state = EXEC;
-  if (swapcontext(&t_threadFiber->m_ctx, &m_ctx)) {
-    LIONET_ASSERT2(false, "swapcontext");
-  }
+  SwitchContext(t_threadFiber.get(), this);
 }
 
 void Fiber::back() {
   SetThis(t_threadFiber.get());
-  if (swapcontext(&m_ctx, &t_threadFiber->m_ctx)) {
-    LIONET_ASSERT2(false, "swapcontext");
-  }
+  SwitchContext(this, t_threadFiber.get());
 }
 
 void Fiber::swapIn() {
   SetThis(this);
   LIONET_ASSERT(this);
   m_state = EXEC;
-  if (swapcontext(&Scheduler::GetMainFiber()->m_ctx, &m_ctx)) {
-    LIONET_ASSERT2(false, "swapcontext");
-  }
+  SwitchContext(GetSwapFiber(), this);
 }
 
 void Fiber::swapOut() {
-  SetThis(Scheduler::GetMainFiber());
-  if (swapcontext(&m_ctx, &Scheduler::GetMainFiber()->m_ctx)) {
-    LIONET_ASSERT2(false, "swapcontext");
+  Fiber* target = GetSwapFiber();
+  SetThis(target);
+  SwitchContext(this, target);
+}
+
+void Fiber::transferTo(Fiber::ptr target) {
+  LIONET_ASSERT(t_fiber == this && m_state == EXEC);
+  Scheduler* sc = Scheduler::GetThis();
+  if (sc && Scheduler::GetRunningFiber() == this) {
+    sc->yieldTo(std::move(target));
+    return;
+  }
+
+  Fiber* to = target.get();
+  LIONET_ASSERT(to && to != this);
+  LIONET_ASSERT(to->m_state != EXEC && to->m_state != TERM &&
+                to->m_state != EXCEPT);
+  LIONET_ASSERT2(!(m_shared && to->m_shared),
+                 "transfer between shared stack fibers needs a scheduler");
+  m_state = READY;
+  to->m_state = EXEC;
+  SetThis(to);
+  SwitchContext(this, to);
+}
+
+namespace {
+/**
+ * @brief join 挂起协程后登记的回调：目标结束时把等待的协程交回它的调度器
+ */
+struct JoinWaker {
+  Scheduler* scheduler;
+  Fiber::ptr waiter;
+
+  void operator()() { scheduler->schedule(std::move(waiter)); }
+};
+
+struct JoinArg {
+  Fiber* target;
+  Scheduler* scheduler;
+};
+}  // namespace
+
+// 等待的协程已经切出，上下文保存完毕，此后目标随时可以唤醒它
+static void ParkJoiner(Fiber::ptr waiter, void* arg) {
+  JoinArg* ja = (JoinArg*)arg;
+  // ja 在等待协程的栈上，被唤醒后可能失效，先取出
+  Fiber* target = ja->target;
+  JoinWaker waker = {ja->scheduler, std::move(waiter)};
+  target->addCompletionCallback(std::move(waker));
+}
+
+void Fiber::join() {
+  {
+    Spinlock::Lock lock(m_completeMutex);
+    if (m_done) {
+      return;
+    }
+  }
+  Fiber* cur = t_fiber;
+  LIONET_ASSERT2(cur != this, "fiber cannot join itself");
+  LIONET_ASSERT2(m_stack || m_shared, "cannot join a thread main fiber");
+
+  Scheduler* sc = Scheduler::GetThis();
+  if (cur && sc && Scheduler::GetRunningFiber() == cur) {
+    JoinArg arg = {this, sc};
+    Scheduler::Park(&ParkJoiner, &arg);
+    return;
+  }
+
+  Semaphore sem;
+  addCompletionCallback([&sem] { sem.notify(); });
+  sem.wait();
+}
+
+void Fiber::addCompletionCallback(Task cb) {
+  {
+    Spinlock::Lock lock(m_completeMutex);
+    if (!m_done) {
+      if (!m_callbacks) {
+        m_callbacks = new std::vector<Task>;
+      }
+      m_callbacks->push_back(std::move(cb));
+      return;
+    }
+  }
+  cb();
+}
+
+void Fiber::complete() {
+  std::vector<Task> callbacks;
+  {
+    Spinlock::Lock lock(m_completeMutex);
+    m_done = true;
+    if (m_callbacks) {
+      callbacks.swap(*m_callbacks);
+    }
+  }
+  for (auto& cb : callbacks) {
+    cb();
   }
 }
 
@@ -156,18 +638,22 @@ void Fiber::SetThis(Fiber* f) {
 }
 
 Fiber::ptr Fiber::GetThis() {
-  if (t_fiber) {
-    return t_fiber->shared_from_this();
+  return Fiber::ptr(Current());
+}
+
+Fiber* Fiber::Current() {
+  if (LIONET_LIKELY(t_fiber != nullptr)) {
+    return t_fiber;
   }
 
   Fiber::ptr main_fiber(new Fiber);
   LIONET_ASSERT(t_fiber == main_fiber.get());
-  t_threadFiber = main_fiber;
-  return t_fiber->shared_from_this();
+  t_threadFiber = std::move(main_fiber);
+  return t_fiber;
 }
 
 void Fiber::YieldToReady() {
-  Fiber::ptr cur = GetThis();
+  Fiber* cur = Current();
   LIONET_ASSERT(cur->m_state == EXEC);
   cur->m_state = READY;
   // cur->back();
@@ -175,19 +661,113 @@ void Fiber::YieldToReady() {
 }
 
 void Fiber::YieldToHold() {
-  Fiber::ptr cur = GetThis();
+  Fiber* cur = Current();
   LIONET_ASSERT(cur->m_state == EXEC);
   cur->m_state = HOLD;
   // cur->back();
   cur->swapOut();
 }
 
+namespace {
+/**
+ * @brief 带超时挂起的状态，挂起的协程与定时器回调通过 mutex 决定由谁恢复协程
+ */
+struct TimedHold {
+  Scheduler* scheduler;
+  uint64_t ms;
+  std::function<void()> wake;  // 定时器回调，登记时交给定时器
+  Spinlock mutex;
+  bool waiting = true;    // 协程还没有从这次挂起中恢复
+  bool timedOut = false;  // 由定时器恢复
+  Fiber::ptr fiber;
+  Timer::ptr timer;
+};
+}  // namespace
+
+// 协程已经切出后再登记定时器，定时器不会在协程切出之前触发；
+// 持有 mutex 直到 timer 赋值完成，被提前恢复的协程在这之后才能读到它。
+// 协程切出后可能在这之前就被其他线程调度并恢复，arg 是堆上的 shared_ptr，
+// 由这里接管并释放，保证状态在使用期间存活；已经恢复时不再登记定时器
+static void ParkTimed(Fiber::ptr fiber, void* arg) {
+  std::unique_ptr<std::shared_ptr<TimedHold> > owner(
+      static_cast<std::shared_ptr<TimedHold>*>(arg));
+  TimedHold* hold = owner->get();
+  Spinlock::Lock lock(hold->mutex);
+  if (!hold->waiting) {
+    return;
+  }
+  hold->fiber = std::move(fiber);
+  hold->timer = hold->scheduler->addTimer(hold->ms, std::move(hold->wake));
+}
+
+bool Fiber::YieldToHold(uint64_t timeout_ms) {
+  Scheduler* sc = Scheduler::GetThis();
+  LIONET_ASSERT2(sc, "YieldToHold with timeout needs a scheduler");
+  std::shared_ptr<TimedHold> hold = std::make_shared<TimedHold>();
+  hold->scheduler = sc;
+  hold->ms = timeout_ms;
+  // 协程恢复后状态随之释放，之后才触发的定时器什么也不做
+  std::weak_ptr<TimedHold> weak(hold);
+  hold->wake = [weak] {
+    std::shared_ptr<TimedHold> hold = weak.lock();
+    if (!hold) {
+      return;
+    }
+    Fiber::ptr fiber;
+    {
+      Spinlock::Lock lock(hold->mutex);
+      // 已经被其他方调度（在队列中或正在运行）时不再重复调度
+      int expected = NOT_QUEUED;
+      if (!hold->waiting ||
+          !hold->fiber->m_queueState.compare_exchange_strong(
+              expected, QUEUED, std::memory_order_acq_rel)) {
+        return;
+      }
+      hold->timedOut = true;
+      fiber = hold->fiber;
+    }
+    hold->scheduler->schedule(std::move(fiber));
+  };
+  Scheduler::Park(&ParkTimed, new std::shared_ptr<TimedHold>(hold));
+
+  Timer::ptr timer;
+  bool timed_out;
+  {
+    // 在 ParkTimed 之前恢复时 timer 为空，标记后 ParkTimed 不再登记
+    Spinlock::Lock lock(hold->mutex);
+    hold->waiting = false;
+    hold->fiber.reset();
+    timer.swap(hold->timer);
+    timed_out = hold->timedOut;
+  }
+  if (!timed_out && timer) {
+    timer->cancel();
+  }
+  return timed_out;
+}
+
+void Fiber::SleepMS(uint64_t ms) {
+  Fiber* cur = t_fiber;
+  if (!cur || !Scheduler::GetThis() || Scheduler::GetRunningFiber() != cur) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return;
+  }
+  // 截止时间按微秒计算，毫秒截断会在一毫秒的后半段开始时提前返回；
+  // 定时器按毫秒触发，提前唤醒或被其他方提前调度时继续睡眠剩余的时间（向上取整）
+  uint64_t deadline = GetMonotonicUS() + ms * 1000;
+  for (uint64_t now = GetMonotonicUS(); now < deadline;
+       now = GetMonotonicUS()) {
+    YieldToHold((deadline - now + 999) / 1000);
+  }
+}
+
 uint64_t Fiber::TotalFibers() {
   return s_fiber_count;
 }
 
 void Fiber::MainFunc() {
-  Fiber::ptr cur = GetThis();
+  // 协程栈上不持有引用，执行结束切出后协程可以被直接释放
+  Fiber* cur = Current();
   LIONET_ASSERT(cur);
 
   try {
@@ -196,27 +776,31 @@ void Fiber::MainFunc() {
     cur->m_state = TERM;
   } catch (std::exception& e) {
     cur->m_state = EXCEPT;
-    LIONET_ERROR(g_logger) << "Fiber Except: " << e.what()
-                           << ", fiber_id=" << cur->getId() << std::endl
-                           << LioNet::BacktraceToString();
+    LIONET_LOG_STACK(g_logger, LioNet::LogLevel::ERROR, 64, "")
+        << "Fiber Except: " << e.what() << ", fiber_id=" << cur->getId()
+        << std::endl;
   } catch (...) {
     cur->m_state = EXCEPT;
     cur->m_state = EXCEPT;
-    LIONET_ERROR(g_logger) << "Fiber Except"
-                           << ", fiber_id=" << cur->getId() << std::endl
-                           << LioNet::BacktraceToString();
+    LIONET_LOG_STACK(g_logger, LioNet::LogLevel::ERROR, 64, "")
+        << "Fiber Except"
+        << ", fiber_id=" << cur->getId() << std::endl;
   }
 
-  auto raw_ptr = cur.get();
-  cur.reset();
-  raw_ptr->swapOut();
+  cur->clearLocals();
+  cur->complete();
+  if (cur->m_shared) {
+    cur->releaseSharedStack();
+  }
+  cur->swapOut();
 
   LIONET_ASSERT2(false,
-                 "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+                 "never reach fiber_id=" + std::to_string(cur->getId()));
 }
 
 void Fiber::CallerMainFunc() {
-  Fiber::ptr cur = GetThis();
+  // 协程栈上不持有引用，执行结束切出后协程可以被直接释放
+  Fiber* cur = Current();
   LIONET_ASSERT(cur);
   try {
     cur->m_func();
@@ -224,22 +808,25 @@ void Fiber::CallerMainFunc() {
     cur->m_state = TERM;
   } catch (std::exception& e) {
     cur->m_state = EXCEPT;
-    LIONET_ERROR(g_logger) << "Fiber Except: " << e.what()
-                           << ", fiber_id=" << cur->getId() << std::endl
-                           << LioNet::BacktraceToString();
+    LIONET_LOG_STACK(g_logger, LioNet::LogLevel::ERROR, 64, "")
+        << "Fiber Except: " << e.what() << ", fiber_id=" << cur->getId()
+        << std::endl;
   } catch (...) {
     cur->m_state = EXCEPT;
-    LIONET_ERROR(g_logger) << "Fiber Except"
-                           << ", fiber_id=" << cur->getId() << std::endl
-                           << LioNet::BacktraceToString();
+    LIONET_LOG_STACK(g_logger, LioNet::LogLevel::ERROR, 64, "")
+        << "Fiber Except"
+        << ", fiber_id=" << cur->getId() << std::endl;
   }
 
-  auto raw_ptr = cur.get();
-  cur.reset();
-  raw_ptr->back();
+  cur->clearLocals();
+  cur->complete();
+  if (cur->m_shared) {
+    cur->releaseSharedStack();
+  }
+  cur->back();
 
   LIONET_ASSERT2(false,
-                 "never reach fiber_id=" + std::to_string(raw_ptr->getId()));
+                 "never reach fiber_id=" + std::to_string(cur->getId()));
 }
 
 }  // namespace LioNet
\ No newline at end of file
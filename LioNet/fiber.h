@@ -7,21 +7,30 @@
 #define __LIONET_FIBER_H__
 
 #include <ucontext.h>
+#include <atomic>
+#include <chrono>
 #include <functional>
 #include <memory>
+#include <vector>
+#include "context.h"
+#include "intrusive_ptr.h"
+#include "mutex.h"
+#include "task.h"
 
 namespace LioNet {
 
 class Scheduler;
+class StackAllocator;
 
 /**
  * @brief 协程类
+ * @details 引用计数嵌入在协程对象中，yield/resume 路径只使用裸指针，不修改引用计数
  */
-class Fiber : public std::enable_shared_from_this<Fiber> {
+class Fiber : public RefCounted<Fiber> {
   friend class Scheduler;
 
  public:
-  typedef std::shared_ptr<Fiber> ptr;
+  typedef IntrusivePtr<Fiber> ptr;
 
   /**
    * @brief 协程状态
@@ -48,9 +57,13 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    * @param[in] func 协程执行函数
    * @param[in] stacksize 协程栈大小
    * @param[in] use_caller 是否在MainFiber上调度
+   * @param[in] shared_stack 是否使用共享栈
+   * @details 共享栈模式下协程第一次运行时绑定当前线程的一块共享栈（忽略 stacksize），
+   *          切出后只有在其他协程需要这块栈时才把已使用部分拷贝到按需分配的私有缓冲区。
+   *          绑定后只能在该线程上运行。ucontext 实现下退化为私有栈。
    */
-  Fiber(std::function<void()> func, size_t stacksize = 0,
-        bool use_caller = false);
+  Fiber(Task func, size_t stacksize = 0, bool use_caller = false,
+        bool shared_stack = false);
 
   ~Fiber();
 
@@ -59,7 +72,7 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    * @pre getState() 为INIT, TERM, EXCEPT
    * @post getState() = INIT
    */
-  void reset(std::function<void()> func);
+  void reset(Task func);
 
   /**
    * @brief 将当前协程切换到运行状态
@@ -86,6 +99,32 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    */
   void back();
 
+  /**
+   * @brief 当前协程让出并直接切换到 target
+   * @pre 执行的为该协程，target 处于 INIT/READY/HOLD 且没有在其他线程运行
+   * @post getState() = READY
+   * @details 在调度器中运行时等价于 Scheduler::yieldTo，本协程由调度器重新入队；
+   *          否则直接切换，target 让出后回到线程主协程，本协程保持 READY 等待再次 swapIn
+   */
+  void transferTo(Fiber::ptr target);
+
+  /**
+   * @brief 等待协程执行结束（TERM/EXCEPT）
+   * @details 在调度器运行的协程中调用时挂起当前协程，结束后由调度器重新调度；
+   *          在普通线程或不受调度器管理的协程中调用时阻塞当前线程。
+   *          后一种情况下目标协程需要由其他线程推进，否则会死锁
+   * @pre 不是当前协程，也不是线程主协程
+   */
+  void join();
+
+  /**
+   * @brief 注册协程执行结束时的回调
+   * @details 在协程结束（TERM/EXCEPT）后、切出之前在该协程上按注册顺序调用；
+   *          已经结束时立即在调用方执行。协程未执行就被销毁时在析构中调用。
+   *          reset 后需要重新注册
+   */
+  void addCompletionCallback(Task cb);
+
   /**
    * @brief 返回协程的id
    */
@@ -96,6 +135,57 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    */
   State getState() const { return m_state; }
 
+  /**
+   * @brief 返回协程栈大小
+   */
+  uint32_t getStackSize() const { return m_stacksize; }
+
+  /**
+   * @brief 地址是否落在协程栈下方的保护页中
+   */
+  bool isGuardAddress(const void* addr) const;
+
+  /**
+   * @brief 是否为共享栈模式
+   */
+  bool isSharedStack() const { return m_shared != nullptr; }
+
+  /**
+   * @brief 返回协程必须运行的线程id，-1 表示可以在任意线程运行
+   * @details 共享栈协程第一次运行后绑定到该线程
+   */
+  int getBoundThread() const;
+
+  /**
+   * @brief 返回调度优先级，-1 表示未指定（按 Scheduler::PRIORITY_NORMAL 调度）
+   * @details 由 Scheduler::schedule 指定，协程让出后重新入队时沿用
+   */
+  int getPriority() const { return m_priority; }
+
+  /**
+   * @brief 返回截止时间（GetCurrentUS 的微秒时间），0 表示没有
+   * @details 由 Scheduler::scheduleDeadline 指定，协程让出后重新入队时沿用
+   */
+  uint64_t getDeadline() const { return m_deadline; }
+
+  /**
+   * @brief 返回协程局部存储槽位的值，未设置返回 nullptr
+   * @param[in] slot RegisterLocalSlot 返回的槽位
+   */
+  void* getLocal(size_t slot) const {
+    if (slot < kInlineLocals) {
+      return m_locals[slot];
+    }
+    return getOverflowLocal(slot);
+  }
+
+  /**
+   * @brief 设置协程局部存储槽位的值，原有的值用注册时的析构函数释放
+   * @param[in] slot RegisterLocalSlot 返回的槽位
+   * @param[in] value 新的值，nullptr 表示清除
+   */
+  void setLocal(size_t slot, void* value);
+
  public:
   /**
    * @brief 设置当前前程的运行协程
@@ -108,6 +198,12 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    */
   static Fiber::ptr GetThis();
 
+  /**
+   * @brief 返回当前所在协程的裸指针，不增加引用计数
+   * @details 当前线程还没有协程时创建主协程
+   */
+  static Fiber* Current();
+
   /**
    * @brief 将当前协程切换到后台，其设置为READY状态
    * @post getState() = READY
@@ -120,6 +216,47 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    */
   static void YieldToHold();
 
+  /**
+   * @brief 将当前协程切换到后台，其设置为HOLD状态，超时后由调度器自动恢复
+   * @details 协程切出之后、超时之前被其他方调度时按其调度恢复，定时器不再调度它；
+   *          与 YieldToHold() 一样，其他方只能在协程挂起期间调度它一次，
+   *          超时恢复之后不能再调度
+   * @param[in] timeout_ms 超时时间（毫秒）
+   * @return 因超时恢复返回 true
+   * @pre 当前协程由调度器运行
+   */
+  static bool YieldToHold(uint64_t timeout_ms);
+
+  /**
+   * @brief 当前协程睡眠 ms 毫秒，期间工作线程继续运行其他协程
+   * @details 不在调度器运行的协程中时阻塞当前线程
+   */
+  static void SleepMS(uint64_t ms);
+
+  /**
+   * @brief 当前协程睡眠一段时间，精度为毫秒，不足一毫秒向上取整
+   */
+  template <class Rep, class Period>
+  static void SleepFor(const std::chrono::duration<Rep, Period>& d) {
+    if (d <= d.zero()) {
+      return;
+    }
+    std::chrono::milliseconds ms =
+        std::chrono::duration_cast<std::chrono::milliseconds>(d);
+    if (ms < d) {
+      ++ms;
+    }
+    SleepMS(ms.count());
+  }
+
+  /**
+   * @brief 当前协程睡眠到时间点 t
+   */
+  template <class Clock, class Duration>
+  static void SleepUntil(const std::chrono::time_point<Clock, Duration>& t) {
+    SleepFor(t - Clock::now());
+  }
+
   /**
    * @brief 返回当前协程总数
    */
@@ -142,13 +279,98 @@ class Fiber : public std::enable_shared_from_this<Fiber> {
    */
   static uint64_t GetFiberId();
 
+  /**
+   * @brief 返回编译时选择的上下文切换实现（"fcontext" 或 "ucontext"）
+   */
+  static const char* ContextBackend();
+
+  /**
+   * @brief 注册一个协程局部存储槽位
+   * @param[in] dtor 协程结束或重置时释放槽位值的函数
+   * @return 槽位下标，所有协程共用
+   * @details 槽位不回收，一般由 FiberLocal 的静态对象在初始化时注册
+   */
+  static size_t RegisterLocalSlot(void (*dtor)(void*));
+
+ private:
+  /**
+   * @brief 在协程栈上构造入口为 fn 的上下文
+   */
+  void makeContext(void (*fn)());
+
+  /**
+   * @brief 保存当前上下文到 from 并切换到 to
+   */
+  static void SwitchContext(Fiber* from, Fiber* to);
+
+  /**
+   * @brief 共享栈模式切入前调用：绑定共享栈，换出栈上原有协程并恢复本协程的栈内容
+   * @pre 不在该共享栈上执行
+   */
+  void prepareSharedStack();
+
+  /**
+   * @brief 共享栈模式：把挂起时已使用的栈拷贝到私有缓冲区
+   */
+  void saveSharedStack();
+
+  /**
+   * @brief 共享栈模式：栈上内容不再需要保存（执行结束或重置）
+   */
+  void releaseSharedStack();
+
+  /**
+   * @brief 返回超出内联槽位部分的局部存储值
+   */
+  void* getOverflowLocal(size_t slot) const;
+
+  /**
+   * @brief 释放所有协程局部存储的值
+   */
+  void clearLocals();
+
+  /**
+   * @brief 标记执行结束并调用完成回调
+   */
+  void complete();
+
+ private:
+  struct SharedStackContext;
+
+  static const size_t kInlineLocals = 8;  // 内联的局部存储槽位数
+
+  /**
+   * @brief 协程在调度队列中的状态，由调度器维护
+   * @details 同一协程在队列中可能留有过期的项，出队时通过 CAS 认领，
+   *          只有从 QUEUED 改为 CLAIMED 成功的一方运行它
+   */
+  enum QueueState {
+    NOT_QUEUED,  // 不在队列中
+    QUEUED,      // 在队列中等待运行
+    CLAIMED      // 已被某个线程取出或正在运行
+  };
+
  private:
-  uint64_t m_id;                 // 协程id
-  uint32_t m_stacksize;          // 协程运行栈大小
-  State m_state;                 // 协程状态
-  ucontext_t m_ctx;              // 协程上下文
-  void* m_stack;                 // 协程运行栈指针
-  std::function<void()> m_func;  // 协程运行函数
+  uint64_t m_id = 0;                       // 协程id
+  uint32_t m_stacksize = 0;                // 协程运行栈大小
+  State m_state = INIT;                    // 协程状态
+#ifdef LIONET_FIBER_UCONTEXT
+  ucontext_t m_ctx;  // 协程上下文
+#else
+  fcontext_t m_ctx = nullptr;  // 协程上下文（挂起时的栈顶）
+#endif
+  void* m_stack = nullptr;                 // 协程运行栈指针
+  StackAllocator* m_allocator = nullptr;   // 协程栈分配器
+  SharedStackContext* m_shared = nullptr;  // 共享栈状态，私有栈为nullptr
+  Task m_func;                             // 协程运行函数
+  void* m_locals[kInlineLocals] = {};      // 协程局部存储内联槽位
+  std::vector<void*>* m_localOverflow = nullptr;  // 超出内联部分的槽位
+  Spinlock m_completeMutex;                 // 保护 m_done 与 m_callbacks
+  bool m_done = false;                      // 本次执行是否已经结束
+  std::vector<Task>* m_callbacks = nullptr;  // 完成回调，按需分配
+  std::atomic<int> m_queueState{NOT_QUEUED};  // 调度队列状态，见 QueueState
+  int m_priority = -1;                        // 调度优先级，-1 未指定
+  uint64_t m_deadline = 0;                    // 截止时间（微秒），0 没有
 };
 }  // namespace LioNet
 
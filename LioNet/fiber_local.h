@@ -0,0 +1,78 @@
+/**
+ * @file fiber_local.h
+ * @brief 协程局部存储
+ */
+
+#ifndef __LIONET_FIBER_LOCAL_H__
+#define __LIONET_FIBER_LOCAL_H__
+
+#include <utility>
+
+#include "fiber.h"
+#include "noncopyable.h"
+
+namespace LioNet {
+
+/**
+ * @brief 协程局部变量
+ * @details 协程让出后可能在其他线程恢复，调度器上运行的代码不能依赖 thread_local。
+ *          FiberLocal 在构造时注册一个固定槽位，每个协程按下标访问自己的值，
+ *          前 8 个槽位内联在 Fiber 中，之后的存放在按需分配的溢出数组里。
+ *          值在协程执行结束（TERM/EXCEPT）、reset 或析构时释放。
+ *          没有调度器时线程主协程上的值相当于线程局部变量。
+ *          一般定义为静态对象，槽位不回收。
+ */
+template <class T>
+class FiberLocal : Noncopyable {
+ public:
+  FiberLocal() : m_slot(Fiber::RegisterLocalSlot(&FiberLocal::Destroy)) {}
+
+  /**
+   * @brief 返回当前协程的值，未设置返回 nullptr
+   */
+  T* get() const {
+    return static_cast<T*>(Fiber::Current()->getLocal(m_slot));
+  }
+
+  /**
+   * @brief 设置当前协程的值
+   */
+  void set(T value) {
+    Fiber::Current()->setLocal(m_slot, new T(std::move(value)));
+  }
+
+  /**
+   * @brief 清除当前协程的值
+   */
+  void reset() { Fiber::Current()->setLocal(m_slot, nullptr); }
+
+  /**
+   * @brief 返回当前协程的值，未设置时默认构造一个
+   */
+  T& operator*() {
+    Fiber* cur = Fiber::Current();
+    T* v = static_cast<T*>(cur->getLocal(m_slot));
+    if (!v) {
+      v = new T();
+      cur->setLocal(m_slot, v);
+    }
+    return *v;
+  }
+
+  T* operator->() { return &**this; }
+
+  /**
+   * @brief 返回槽位下标
+   */
+  size_t getSlot() const { return m_slot; }
+
+ private:
+  static void Destroy(void* vp) { delete static_cast<T*>(vp); }
+
+ private:
+  size_t m_slot;  // 槽位下标
+};
+
+}  // namespace LioNet
+
+#endif
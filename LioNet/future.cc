@@ -0,0 +1,170 @@
+#include "future.h"
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "scheduler.h"
+
+namespace LioNet {
+
+static void FutexWait(std::atomic<uint32_t>* addr, uint32_t expected) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE,
+          expected, nullptr, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t>* addr) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, 1,
+          nullptr, nullptr, 0);
+}
+
+namespace {
+/**
+ * @brief 挂起的协程，在它的栈上
+ */
+struct FiberWaiter : FutureStateBase::Waiter {
+  FutureStateBase* state;
+  Fiber::ptr fiber;
+  Scheduler* scheduler;
+};
+
+/**
+ * @brief 阻塞的线程，在它的栈上
+ */
+struct ThreadWaiter : FutureStateBase::Waiter {
+  std::atomic<uint32_t> ready{0};
+};
+
+/**
+ * @brief 延续回调，在堆上，通知后释放
+ */
+struct CallbackWaiter : FutureStateBase::Waiter {
+  Task cb;
+};
+
+/**
+ * @brief 把回调交给调度器运行
+ */
+struct ScheduleOn {
+  void operator()() { scheduler->schedule(std::move(cb)); }
+
+  Scheduler* scheduler;
+  Task cb;
+};
+}  // namespace
+
+// 先取出需要的字段，调度之后协程可能立即恢复，它栈上的等待者随之失效
+static void NotifyFiber(FutureStateBase::Waiter* w) {
+  FiberWaiter* waiter = static_cast<FiberWaiter*>(w);
+  Scheduler* scheduler = waiter->scheduler;
+  Fiber::ptr fiber = std::move(waiter->fiber);
+  scheduler->schedule(std::move(fiber));
+}
+
+// 等待的线程看到 ready 后可能已经返回，地址仍在它的栈上，唤醒最多造成一次虚假唤醒
+static void NotifyThread(FutureStateBase::Waiter* w) {
+  ThreadWaiter* waiter = static_cast<ThreadWaiter*>(w);
+  waiter->ready.store(1, std::memory_order_release);
+  FutexWake(&waiter->ready);
+}
+
+static void NotifyCallback(FutureStateBase::Waiter* w) {
+  CallbackWaiter* waiter = static_cast<CallbackWaiter*>(w);
+  waiter->cb();
+  delete waiter;
+}
+
+FutureStateBase::~FutureStateBase() {
+  // 未就绪的状态随最后一个 Promise/Future 释放时不会再有等待者
+  LIONET_ASSERT(m_state.load(std::memory_order_relaxed) == 0 || isReady());
+}
+
+void FutureStateBase::claim() {
+  bool claimed = m_claimed.exchange(true, std::memory_order_relaxed);
+  LIONET_ASSERT2(!claimed, "future result already set");
+}
+
+void FutureStateBase::setException(std::exception_ptr error) {
+  claim();
+  m_error = error;
+  markReady();
+}
+
+bool FutureStateBase::addWaiter(Waiter* waiter) {
+  uintptr_t head = m_state.load(std::memory_order_acquire);
+  do {
+    if (head == kReady) {
+      return false;
+    }
+    waiter->next = reinterpret_cast<Waiter*>(head);
+  } while (!m_state.compare_exchange_weak(head,
+                                          reinterpret_cast<uintptr_t>(waiter),
+                                          std::memory_order_release,
+                                          std::memory_order_acquire));
+  return true;
+}
+
+void FutureStateBase::markReady() {
+  uintptr_t head = m_state.exchange(kReady, std::memory_order_acq_rel);
+  // 链表是后进先出，反转后按登记的顺序通知
+  Waiter* list = nullptr;
+  Waiter* w = reinterpret_cast<Waiter*>(head);
+  while (w) {
+    Waiter* next = w->next;
+    w->next = list;
+    list = w;
+    w = next;
+  }
+  while (list) {
+    Waiter* next = list->next;
+    list->notify(list);
+    list = next;
+  }
+}
+
+void FutureStateBase::ParkWaiter(Fiber::ptr fiber, void* arg) {
+  FiberWaiter* waiter = (FiberWaiter*)arg;
+  waiter->fiber = std::move(fiber);
+  waiter->scheduler = Scheduler::GetThis();
+  if (!waiter->state->addWaiter(waiter)) {
+    NotifyFiber(waiter);
+  }
+}
+
+void FutureStateBase::wait() {
+  if (isReady()) {
+    return;
+  }
+  if (Scheduler::GetThis() &&
+      Scheduler::GetRunningFiber() == Fiber::Current()) {
+    FiberWaiter waiter;
+    waiter.notify = &NotifyFiber;
+    waiter.state = this;
+    Scheduler::Park(&ParkWaiter, &waiter);
+    return;
+  }
+  ThreadWaiter waiter;
+  waiter.notify = &NotifyThread;
+  if (!addWaiter(&waiter)) {
+    return;
+  }
+  while (waiter.ready.load(std::memory_order_acquire) == 0) {
+    FutexWait(&waiter.ready, 0);
+  }
+}
+
+void FutureStateBase::addCallback(Task cb, Scheduler* scheduler) {
+  if (scheduler) {
+    cb = ScheduleOn{scheduler, std::move(cb)};
+  }
+  if (isReady()) {
+    cb();
+    return;
+  }
+  CallbackWaiter* waiter = new CallbackWaiter;
+  waiter->notify = &NotifyCallback;
+  waiter->cb = std::move(cb);
+  if (!addWaiter(waiter)) {
+    NotifyCallback(waiter);
+  }
+}
+
+}  // namespace LioNet
@@ -0,0 +1,425 @@
+/**
+ * @file future.h
+ * @brief 挂起协程而不阻塞线程的 Future/Promise
+ */
+
+#ifndef __LIONET_FUTURE_H__
+#define __LIONET_FUTURE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "fiber.h"
+#include "macro.h"
+#include "noncopyable.h"
+#include "task.h"
+
+namespace LioNet {
+
+class Scheduler;
+
+/**
+ * @brief Future 共享状态中与值类型无关的部分
+ * @details 状态是一个原子字：0 未就绪，1 已就绪，其他值为等待者链表的表头。
+ *          等待者和回调用 CAS 压入链表，设置结果时一次交换取走整个链表，
+ *          等待、设置结果都不加锁。已就绪时 get() 只读一次原子变量
+ */
+class FutureStateBase : Noncopyable {
+ public:
+  /**
+   * @brief 等待者，结果就绪时调用 notify
+   */
+  struct Waiter {
+    Waiter* next = nullptr;
+    void (*notify)(Waiter*) = nullptr;
+  };
+
+  virtual ~FutureStateBase();
+
+  /**
+   * @brief 结果是否已经就绪
+   */
+  bool isReady() const {
+    return m_state.load(std::memory_order_acquire) == kReady;
+  }
+
+  /**
+   * @brief 等待结果就绪
+   * @details 在调度器运行的协程中挂起协程，就绪时重新调度；否则在 futex 上阻塞线程
+   */
+  void wait();
+
+  /**
+   * @brief 结果就绪后调用 cb
+   * @param[in] cb 回调
+   * @param[in] scheduler 在该调度器上运行回调，nullptr 在设置结果的线程上直接运行
+   *            （已经就绪时在当前线程上直接运行）
+   */
+  void addCallback(Task cb, Scheduler* scheduler = nullptr);
+
+  /**
+   * @brief 设置异常并就绪
+   */
+  void setException(std::exception_ptr error);
+
+  /**
+   * @brief 返回异常，没有异常时为空
+   * @pre isReady()
+   */
+  const std::exception_ptr& getException() const { return m_error; }
+
+ protected:
+  /**
+   * @brief 认领设置结果的权利，只能设置一次
+   */
+  void claim();
+
+  /**
+   * @brief 发布结果并通知所有等待者
+   */
+  void markReady();
+
+  /**
+   * @brief 结果就绪后重新抛出异常
+   */
+  void rethrow() const {
+    if (m_error) {
+      std::rethrow_exception(m_error);
+    }
+  }
+
+ private:
+  /**
+   * @brief 压入等待者
+   * @return 已经就绪时返回 false，不压入
+   */
+  bool addWaiter(Waiter* waiter);
+
+  /**
+   * @brief 挂起等待的协程后登记为等待者
+   */
+  static void ParkWaiter(Fiber::ptr fiber, void* arg);
+
+ private:
+  static const uintptr_t kReady = 1;
+
+  std::atomic<uintptr_t> m_state{0};
+  std::atomic<bool> m_claimed{false};
+  std::exception_ptr m_error;
+};
+
+/**
+ * @brief Future 共享状态，保存结果值
+ */
+template <class T>
+class FutureState : public FutureStateBase {
+ public:
+  ~FutureState() {
+    if (m_hasValue) {
+      reinterpret_cast<T*>(&m_storage)->~T();
+    }
+  }
+
+  template <class U>
+  void setValue(U&& value) {
+    claim();
+    new (&m_storage) T(std::forward<U>(value));
+    m_hasValue = true;
+    markReady();
+  }
+
+  /**
+   * @brief 等待并返回结果，有异常时重新抛出
+   */
+  const T& get() {
+    wait();
+    rethrow();
+    return *reinterpret_cast<const T*>(&m_storage);
+  }
+
+ private:
+  typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+  bool m_hasValue = false;
+};
+
+template <>
+class FutureState<void> : public FutureStateBase {
+ public:
+  void setValue() {
+    claim();
+    markReady();
+  }
+
+  void get() {
+    wait();
+    rethrow();
+  }
+};
+
+template <class T>
+class Promise;
+
+/**
+ * @brief 异步结果
+ * @details 可以拷贝，拷贝共享同一个结果。get() 在协程中挂起协程，工作线程继续运行其他任务
+ */
+template <class T>
+class Future {
+ public:
+  typedef std::shared_ptr<FutureState<T> > StatePtr;
+
+  Future() {}
+
+  explicit Future(StatePtr state) : m_state(std::move(state)) {}
+
+  /**
+   * @brief 是否关联了结果
+   */
+  bool valid() const { return m_state != nullptr; }
+
+  /**
+   * @brief 结果是否已经就绪
+   */
+  bool isReady() const { return m_state->isReady(); }
+
+  /**
+   * @brief 等待结果就绪，不抛出异常
+   */
+  void wait() const { m_state->wait(); }
+
+  /**
+   * @brief 等待并返回结果，有异常时重新抛出
+   * @details 非 void 的结果以引用返回，在 Future 析构之前有效
+   */
+  auto get() const -> decltype(std::declval<FutureState<T>&>().get()) {
+    return m_state->get();
+  }
+
+  /**
+   * @brief 结果是否为异常
+   * @pre isReady()
+   */
+  bool hasException() const { return m_state->getException() != nullptr; }
+
+  /**
+   * @brief 返回异常，没有异常时为空
+   * @pre isReady()
+   */
+  std::exception_ptr getException() const { return m_state->getException(); }
+
+  /**
+   * @brief 添加延续：结果就绪后调用 fn(*this)，返回 fn 的结果
+   * @param[in] fn 延续函数，以就绪的 Future 为参数，可以在其中 get() 取值或异常
+   * @param[in] scheduler 在该调度器上运行 fn，nullptr 在设置结果的线程上直接运行
+   * @details fn 抛出的异常进入返回的 Future
+   */
+  template <class F>
+  Future<typename std::result_of<F(Future<T>)>::type> then(
+      F&& fn, Scheduler* scheduler = nullptr) const;
+
+ private:
+  StatePtr m_state;
+};
+
+/**
+ * @brief 结果的设置方
+ * @details 只能移动。析构时还没有设置结果则设置 broken_promise 异常
+ */
+template <class T>
+class Promise {
+ public:
+  Promise() : m_state(std::make_shared<FutureState<T> >()) {}
+
+  Promise(Promise&& rhs) noexcept : m_state(std::move(rhs.m_state)) {}
+
+  Promise& operator=(Promise&& rhs) noexcept {
+    if (this != &rhs) {
+      abandon();
+      m_state = std::move(rhs.m_state);
+    }
+    return *this;
+  }
+
+  Promise(const Promise&) = delete;
+  Promise& operator=(const Promise&) = delete;
+
+  ~Promise() { abandon(); }
+
+  /**
+   * @brief 返回关联的 Future
+   */
+  Future<T> getFuture() const { return Future<T>(m_state); }
+
+  /**
+   * @brief 设置结果值（void 不带参数），唤醒所有等待者并运行延续
+   */
+  template <class... Args>
+  void setValue(Args&&... args) {
+    m_state->setValue(std::forward<Args>(args)...);
+    m_done = true;
+  }
+
+  /**
+   * @brief 设置异常
+   */
+  void setException(std::exception_ptr error) {
+    m_state->setException(error);
+    m_done = true;
+  }
+
+ private:
+  void abandon();
+
+ private:
+  std::shared_ptr<FutureState<T> > m_state;
+  bool m_done = false;
+};
+
+/**
+ * @brief 调用 fn 并把结果或异常交给 promise
+ */
+template <class R>
+struct FutureFulfill {
+  template <class F, class... Args>
+  static void Run(Promise<R>& promise, F& fn, Args&&... args) {
+    try {
+      promise.setValue(fn(std::forward<Args>(args)...));
+    } catch (...) {
+      promise.setException(std::current_exception());
+    }
+  }
+};
+
+template <>
+struct FutureFulfill<void> {
+  template <class F, class... Args>
+  static void Run(Promise<void>& promise, F& fn, Args&&... args) {
+    try {
+      fn(std::forward<Args>(args)...);
+    } catch (...) {
+      promise.setException(std::current_exception());
+      return;
+    }
+    promise.setValue();
+  }
+};
+
+/**
+ * @brief Scheduler::async 调度的任务：运行函数并设置结果
+ */
+template <class R, class F>
+struct FutureTask {
+  FutureTask(Promise<R>&& p, F&& f)
+      : promise(std::move(p)), fn(std::move(f)) {}
+  FutureTask(Promise<R>&& p, const F& f) : promise(std::move(p)), fn(f) {}
+
+  void operator()() { FutureFulfill<R>::Run(promise, fn); }
+
+  Promise<R> promise;
+  F fn;
+};
+
+/**
+ * @brief then() 的延续：以就绪的 Future 调用函数并设置结果
+ */
+template <class T, class R, class F>
+struct FutureThen {
+  void operator()() { FutureFulfill<R>::Run(promise, fn, source); }
+
+  Future<T> source;
+  Promise<R> promise;
+  F fn;
+};
+
+template <class T>
+void Promise<T>::abandon() {
+  if (m_state && !m_done) {
+    m_state->setException(std::make_exception_ptr(
+        std::future_error(std::future_errc::broken_promise)));
+  }
+}
+
+template <class T>
+template <class F>
+Future<typename std::result_of<F(Future<T>)>::type> Future<T>::then(
+    F&& fn, Scheduler* scheduler) const {
+  typedef typename std::result_of<F(Future<T>)>::type R;
+  Promise<R> promise;
+  Future<R> result = promise.getFuture();
+  m_state->addCallback(
+      FutureThen<T, R, typename std::decay<F>::type>{
+          *this, std::move(promise), std::forward<F>(fn)},
+      scheduler);
+  return result;
+}
+
+/**
+ * @brief 所有 Future 就绪后就绪
+ * @details 有异常时取排在最前面的那个异常，否则为 void 结果。输入为空时立即就绪
+ */
+template <class T>
+Future<void> WhenAll(const std::vector<Future<T> >& futures) {
+  struct Context {
+    std::atomic<size_t> remaining{0};
+    std::vector<Future<T> > futures;
+    Promise<void> promise;
+  };
+  std::shared_ptr<Context> ctx = std::make_shared<Context>();
+  Future<void> result = ctx->promise.getFuture();
+  if (futures.empty()) {
+    ctx->promise.setValue();
+    return result;
+  }
+  ctx->remaining = futures.size();
+  ctx->futures = futures;
+  for (auto& f : futures) {
+    f.then([ctx](Future<T>) {
+      if (ctx->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+        return;
+      }
+      for (auto& i : ctx->futures) {
+        if (i.hasException()) {
+          ctx->promise.setException(i.getException());
+          return;
+        }
+      }
+      ctx->promise.setValue();
+    });
+  }
+  return result;
+}
+
+/**
+ * @brief 任意一个 Future 就绪后就绪，结果为它的下标（不论它是值还是异常）
+ * @pre futures 非空
+ */
+template <class T>
+Future<size_t> WhenAny(const std::vector<Future<T> >& futures) {
+  LIONET_ASSERT(!futures.empty());
+  struct Context {
+    std::atomic<bool> done{false};
+    Promise<size_t> promise;
+  };
+  std::shared_ptr<Context> ctx = std::make_shared<Context>();
+  Future<size_t> result = ctx->promise.getFuture();
+  for (size_t i = 0; i < futures.size(); ++i) {
+    futures[i].then([ctx, i](Future<T>) {
+      if (!ctx->done.exchange(true, std::memory_order_acq_rel)) {
+        ctx->promise.setValue(i);
+      }
+    });
+  }
+  return result;
+}
+
+}  // namespace LioNet
+
+#endif
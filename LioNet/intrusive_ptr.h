@@ -0,0 +1,169 @@
+/**
+ * @file intrusive_ptr.h
+ * @brief 侵入式引用计数智能指针
+ */
+
+#ifndef __LIONET_INTRUSIVE_PTR_H__
+#define __LIONET_INTRUSIVE_PTR_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+namespace LioNet {
+
+/**
+ * @brief 侵入式引用计数基类
+ * @details T 为派生类（CRTP），计数归零时 delete static_cast<T*>(this)。
+ *          计数存放在对象内部，可以从裸指针重新构造 IntrusivePtr 而不需要 shared_from_this，
+ *          只转移所有权（移动）时不修改计数。
+ */
+template <class T>
+class RefCounted {
+ public:
+  RefCounted() = default;
+  RefCounted(const RefCounted&) = delete;
+  RefCounted& operator=(const RefCounted&) = delete;
+
+  /**
+   * @brief 增加引用计数
+   */
+  void ref() const { m_refs.fetch_add(1, std::memory_order_relaxed); }
+
+  /**
+   * @brief 减少引用计数，归零时释放对象
+   */
+  void unref() const {
+    if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete static_cast<const T*>(this);
+    }
+  }
+
+  /**
+   * @brief 返回当前引用计数（仅用于调试和测试）
+   */
+  uint32_t getRefCount() const {
+    return m_refs.load(std::memory_order_relaxed);
+  }
+
+ protected:
+  ~RefCounted() = default;
+
+ private:
+  mutable std::atomic<uint32_t> m_refs{0};
+};
+
+/**
+ * @brief 侵入式智能指针
+ * @details 接口与 std::shared_ptr 常用部分保持一致（get/reset/bool/比较），
+ *          T 需提供 ref() 和 unref()
+ */
+template <class T>
+class IntrusivePtr {
+ public:
+  IntrusivePtr() = default;
+
+  IntrusivePtr(std::nullptr_t) {}
+
+  /**
+   * @brief 接管裸指针并增加引用计数
+   */
+  explicit IntrusivePtr(T* p) : m_ptr(p) {
+    if (m_ptr) {
+      m_ptr->ref();
+    }
+  }
+
+  IntrusivePtr(const IntrusivePtr& rhs) : m_ptr(rhs.m_ptr) {
+    if (m_ptr) {
+      m_ptr->ref();
+    }
+  }
+
+  IntrusivePtr(IntrusivePtr&& rhs) noexcept : m_ptr(rhs.m_ptr) {
+    rhs.m_ptr = nullptr;
+  }
+
+  ~IntrusivePtr() {
+    if (m_ptr) {
+      m_ptr->unref();
+    }
+  }
+
+  IntrusivePtr& operator=(const IntrusivePtr& rhs) {
+    IntrusivePtr(rhs).swap(*this);
+    return *this;
+  }
+
+  IntrusivePtr& operator=(IntrusivePtr&& rhs) noexcept {
+    IntrusivePtr(std::move(rhs)).swap(*this);
+    return *this;
+  }
+
+  IntrusivePtr& operator=(std::nullptr_t) {
+    reset();
+    return *this;
+  }
+
+  void reset() { IntrusivePtr().swap(*this); }
+
+  void reset(T* p) { IntrusivePtr(p).swap(*this); }
+
+  void swap(IntrusivePtr& rhs) noexcept {
+    T* tmp = m_ptr;
+    m_ptr = rhs.m_ptr;
+    rhs.m_ptr = tmp;
+  }
+
+  T* get() const { return m_ptr; }
+
+  T& operator*() const { return *m_ptr; }
+
+  T* operator->() const { return m_ptr; }
+
+  explicit operator bool() const { return m_ptr != nullptr; }
+
+ private:
+  T* m_ptr = nullptr;
+};
+
+template <class T, class U>
+bool operator==(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) {
+  return a.get() == b.get();
+}
+
+template <class T, class U>
+bool operator!=(const IntrusivePtr<T>& a, const IntrusivePtr<U>& b) {
+  return a.get() != b.get();
+}
+
+template <class T>
+bool operator==(const IntrusivePtr<T>& a, std::nullptr_t) {
+  return !a;
+}
+
+template <class T>
+bool operator==(std::nullptr_t, const IntrusivePtr<T>& a) {
+  return !a;
+}
+
+template <class T>
+bool operator!=(const IntrusivePtr<T>& a, std::nullptr_t) {
+  return static_cast<bool>(a);
+}
+
+template <class T>
+bool operator!=(std::nullptr_t, const IntrusivePtr<T>& a) {
+  return static_cast<bool>(a);
+}
+
+template <class T>
+bool operator<(const IntrusivePtr<T>& a, const IntrusivePtr<T>& b) {
+  return std::less<T*>()(a.get(), b.get());
+}
+
+}  // namespace LioNet
+
+#endif
@@ -7,11 +7,22 @@
 #define __LIONET_LIONET_H__
 
 #include "config.h"
+#include "cpu_topology.h"
 #include "fiber.h"
+#include "fiber_local.h"
+#include "future.h"
 #include "log.h"
 #include "macro.h"
+#include "mpmc_queue.h"
+#include "parallel.h"
 #include "scheduler.h"
+#include "scheduler_group.h"
+#include "stack_allocator.h"
+#include "task.h"
+#include "task_graph.h"
 #include "thread.h"
+#include "timer.h"
 #include "util.h"
+#include "work_stealing_queue.h"
 
 #endif
\ No newline at end of file
@@ -55,6 +55,17 @@ std::stringstream& LogEventWrap::getSS() {
   return m_event->getSS();
 }
 
+const std::string& LogEvent::getStackTraceString() {
+  // 频率限制按事件计算一次，多个输出目标看到相同的内容
+  if (!m_stackTraceDumped && m_stackTrace) {
+    std::stringstream ss;
+    m_stackTrace->dumpLimited(ss);
+    m_stackTraceString = ss.str();
+    m_stackTraceDumped = true;
+  }
+  return m_stackTraceString;
+}
+
 void LogEvent::format(const char* fmt, ...) {
   va_list al;
   va_start(al, fmt);
@@ -91,7 +102,15 @@ class MessageFormatItem : public LogFormatter::FormatItem {
   MessageFormatItem(const std::string& str = "") {}
   void format(std::ostream& os, Logger::ptr logger, LogLevel::Level level,
               LogEvent::ptr event) override {
-    os << event->getContent();
+    std::string content = event->getContent();
+    os << content;
+    if (event->getStackTrace()) {
+      // 调用栈从新的一行开始
+      if (!content.empty() && content.back() != '\n') {
+        os << '\n';
+      }
+      os << event->getStackTraceString();
+    }
   }
 };
 
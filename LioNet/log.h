@@ -42,6 +42,20 @@
 
 #define LIONET_FATAL(logger) LIONET_LOG_LEVEL(logger, LioNet::LogLevel::FATAL)
 
+/**
+ * @brief 使用流式方式将日志连同当前调用栈写入到logger
+ * @details 调用栈只记录返回地址，格式化时在消息之后符号化输出（受
+ *          backtrace.rate_limit_ms 限制）；被级别过滤的日志不做符号化
+ */
+#define LIONET_LOG_STACK(logger, level, size, prefix)                  \
+  if (logger->getLevel() <= level)                                     \
+  LioNet::LogEventWrap(                                                \
+      LioNet::LogEvent::ptr(new LioNet::LogEvent(                      \
+          logger, level, __FILE__, __LINE__, 0, LioNet::GetThreadId(), \
+          LioNet::GetFiberId(), time(0), LioNet::Thread::GetName())))  \
+      .setStackTrace(new LioNet::StackTrace(size, 1, prefix))          \
+      .getSS()
+
 /**
  * @brief 使用格式化方式将日志级别level的日志写入到logger
  */
@@ -153,6 +167,18 @@ class LogEvent {
 
   std::stringstream& getSS() { return m_ss; }
 
+  /**
+   * @brief 附加调用栈，接管所有权
+   */
+  void setStackTrace(StackTrace* st) { m_stackTrace.reset(st); }
+
+  const StackTrace* getStackTrace() const { return m_stackTrace.get(); }
+
+  /**
+   * @brief 返回符号化后的调用栈，第一次调用时生成，之后各输出目标共用
+   */
+  const std::string& getStackTraceString();
+
   void format(const char* fmt, ...);
   void format(const char* fmt, va_list al);
 
@@ -167,6 +193,9 @@ class LogEvent {
   std::string m_threadName;          // 线程名
   std::shared_ptr<Logger> m_logger;  // 日志器
   LogLevel::Level m_level;           // 日志等级
+  std::unique_ptr<StackTrace> m_stackTrace;  // 附加的原始调用栈
+  std::string m_stackTraceString;            // 符号化后的调用栈
+  bool m_stackTraceDumped = false;           // 是否已经符号化
 };
 
 /**
@@ -178,6 +207,15 @@ class LogEventWrap {
   ~LogEventWrap();
 
   LogEvent::ptr getEvent() const { return m_event; }
+
+  /**
+   * @brief 给日志事件附加调用栈
+   */
+  LogEventWrap& setStackTrace(StackTrace* st) {
+    m_event->setStackTrace(st);
+    return *this;
+  }
+
   std::stringstream& getSS();
 
  private:
@@ -191,7 +229,7 @@ class LogFormatter {
   * @brief 构造函数
   * @param[in] pattern 格式模板
   * @details 
-  *  %m 消息
+  *  %m 消息，附加的调用栈在消息之后输出
   *  %p 日志级别
   *  %r 累计毫秒数
   *  %c 日志名称
@@ -21,22 +21,22 @@
 #endif
 
 /// 断言宏封装
-#define LIONET_ASSERT(x)                              \
-  if (LIONET_UNLIKELY(!(x))) {                        \
-    LIONET_ERROR(LIONET_LOG_ROOT())                   \
-        << "ASSERTION: " #x << "\nbacktrace:\n"       \
-        << LioNet::BacktraceToString(100, 2, "    "); \
-    assert(x);                                        \
+#define LIONET_ASSERT(x)                                                 \
+  if (LIONET_UNLIKELY(!(x))) {                                           \
+    LIONET_LOG_STACK(LIONET_LOG_ROOT(), LioNet::LogLevel::ERROR, 100,    \
+                     "    ")                                             \
+        << "ASSERTION: " #x << "\nbacktrace:\n";                         \
+    assert(x);                                                           \
   }
 
 /// 断言宏封装
-#define LIONET_ASSERT2(x, w)                          \
-  if (LIONET_UNLIKELY(!(x))) {                        \
-    LIONET_ERROR(LIONET_LOG_ROOT())                   \
-        << "ASSERTION: " #x << "\n"                   \
-        << w << "\nbacktrace:\n"                      \
-        << LioNet::BacktraceToString(100, 2, "    "); \
-    assert(x);                                        \
+#define LIONET_ASSERT2(x, w)                                             \
+  if (LIONET_UNLIKELY(!(x))) {                                           \
+    LIONET_LOG_STACK(LIONET_LOG_ROOT(), LioNet::LogLevel::ERROR, 100,    \
+                     "    ")                                             \
+        << "ASSERTION: " #x << "\n"                                      \
+        << w << "\nbacktrace:\n";                                        \
+    assert(x);                                                           \
   }
 
 #endif
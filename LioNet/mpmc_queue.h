@@ -0,0 +1,166 @@
+/**
+ * @file mpmc_queue.h
+ * @brief 有界无锁多生产者多消费者队列
+ */
+
+#ifndef __LIONET_MPMC_QUEUE_H__
+#define __LIONET_MPMC_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "noncopyable.h"
+
+namespace LioNet {
+
+/**
+ * @brief 有界无锁 MPMC 队列（Vyukov）
+ * @details 环形数组的每个槽位带一个序号，生产者和消费者各自 CAS 推进位置，
+ *          认领槽位后再读写数据并发布序号，槽位之间互不干扰。
+ *          元素按值存放在槽位中，入队出队不分配内存。
+ *          tryPopBulk 一次 CAS 取走从队头开始连续就绪的多个元素。
+ */
+template <class T>
+class MPMCQueue : Noncopyable {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] capacity 容量，取整到 2 的幂
+   */
+  explicit MPMCQueue(size_t capacity) {
+    size_t cap = 2;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    m_mask = cap - 1;
+    m_cells = new Cell[cap];
+    for (size_t i = 0; i < cap; ++i) {
+      m_cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~MPMCQueue() {
+    T v;
+    while (tryPop(v)) {
+    }
+    delete[] m_cells;
+  }
+
+  /**
+   * @brief 入队
+   * @return 队列已满返回 false，此时 v 保持不变
+   */
+  bool tryPush(T&& v) {
+    Cell* cell;
+    size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+    while (true) {
+      cell = &m_cells[pos & m_mask];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t dif = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (dif == 0) {
+        if (m_enqueuePos.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = m_enqueuePos.load(std::memory_order_relaxed);
+      }
+    }
+    ::new (&cell->storage) T(std::move(v));
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * @brief 出队一个元素
+   * @return 队列为空返回 false
+   */
+  bool tryPop(T& v) { return tryPopBulk(&v, 1) == 1; }
+
+  /**
+   * @brief 批量出队
+   * @param[out] out 至少 max 个元素的数组，出队的元素移动赋值到其中
+   * @param[in] max 最多出队的数量
+   * @return 出队的数量，队列为空返回 0
+   */
+  size_t tryPopBulk(T* out, size_t max) {
+    if (max > m_mask + 1) {
+      max = m_mask + 1;
+    }
+    size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+    size_t n = 0;
+    while (true) {
+      n = 0;
+      while (n < max && m_cells[(pos + n) & m_mask].seq.load(
+                            std::memory_order_acquire) == pos + n + 1) {
+        ++n;
+      }
+      if (n == 0) {
+        size_t seq = m_cells[pos & m_mask].seq.load(std::memory_order_acquire);
+        if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0) {
+          return 0;
+        }
+        // 队头已被其他消费者取走
+        pos = m_dequeuePos.load(std::memory_order_relaxed);
+        continue;
+      }
+      if (m_dequeuePos.compare_exchange_weak(pos, pos + n,
+                                             std::memory_order_relaxed)) {
+        break;
+      }
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+      Cell& cell = m_cells[(pos + i) & m_mask];
+      T* p = reinterpret_cast<T*>(&cell.storage);
+      out[i] = std::move(*p);
+      p->~T();
+      cell.seq.store(pos + i + m_mask + 1, std::memory_order_release);
+    }
+    return n;
+  }
+
+  /**
+   * @brief 返回元素数量（并发修改时为近似值，包含已认领但未发布的槽位）
+   */
+  size_t size() const {
+    size_t tail = m_enqueuePos.load(std::memory_order_relaxed);
+    size_t head = m_dequeuePos.load(std::memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+  }
+
+  /**
+   * @brief 是否为空（并发修改时为近似值）
+   */
+  bool empty() const { return size() == 0; }
+
+  /**
+   * @brief 返回容量
+   */
+  size_t capacity() const { return m_mask + 1; }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;  // 等于位置时可写，等于位置+1时可读
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+  };
+
+ private:
+  Cell* m_cells = nullptr;  // 环形数组
+  size_t m_mask = 0;        // 容量 - 1
+  // 生产者和消费者的位置隔开到不同缓存行上
+  char m_pad0[64 - sizeof(Cell*) - sizeof(size_t)];
+  std::atomic<size_t> m_enqueuePos{0};
+  char m_pad1[64 - sizeof(std::atomic<size_t>)];
+  std::atomic<size_t> m_dequeuePos{0};
+};
+
+}  // namespace LioNet
+
+#endif
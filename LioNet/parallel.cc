@@ -0,0 +1,81 @@
+#include "parallel.h"
+
+namespace LioNet {
+
+void ParallelContext::done() {
+  Fiber::ptr waiter;
+  Scheduler* scheduler = nullptr;
+  Semaphore* sem = nullptr;
+  {
+    Spinlock::Lock lock(m_mutex);
+    if (m_pending.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+      return;
+    }
+    waiter.swap(m_waiter);
+    scheduler = m_waiterScheduler;
+    sem = m_waiterSem;
+  }
+  // 解锁之后等待者可能已经返回，只使用取出的局部变量
+  if (waiter) {
+    scheduler->schedule(std::move(waiter));
+  } else if (sem) {
+    sem->notify();
+  }
+}
+
+void ParallelContext::fail(std::exception_ptr error) {
+  Spinlock::Lock lock(m_mutex);
+  if (!m_error) {
+    m_error = error;
+  }
+  m_failed.store(true, std::memory_order_relaxed);
+}
+
+void ParallelContext::ParkWaiter(Fiber::ptr fiber, void* arg) {
+  ParallelContext* ctx = (ParallelContext*)arg;
+  Scheduler* scheduler = Scheduler::GetThis();
+  {
+    Spinlock::Lock lock(ctx->m_mutex);
+    if (ctx->m_pending.load(std::memory_order_acquire) != 0) {
+      ctx->m_waiter = std::move(fiber);
+      ctx->m_waiterScheduler = scheduler;
+      return;
+    }
+  }
+  scheduler->schedule(std::move(fiber));
+}
+
+void ParallelContext::wait() {
+  bool pending;
+  {
+    Spinlock::Lock lock(m_mutex);
+    pending = m_pending.load(std::memory_order_acquire) != 0;
+  }
+  if (pending) {
+    Fiber* cur = Fiber::Current();
+    if (Scheduler::GetThis() && Scheduler::GetRunningFiber() == cur) {
+      Scheduler::Park(&ParkWaiter, this);
+    } else {
+      Semaphore sem;
+      {
+        Spinlock::Lock lock(m_mutex);
+        pending = m_pending.load(std::memory_order_acquire) != 0;
+        if (pending) {
+          m_waiterSem = &sem;
+        }
+      }
+      if (pending) {
+        sem.wait();
+      }
+    }
+  }
+  // 最后一个 done() 在锁内取走等待者，这里加锁保证它已经不再访问本对象
+  Spinlock::Lock lock(m_mutex);
+  if (m_error) {
+    std::exception_ptr error = m_error;
+    lock.unlock();
+    std::rethrow_exception(error);
+  }
+}
+
+}  // namespace LioNet
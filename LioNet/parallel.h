@@ -0,0 +1,232 @@
+/**
+ * @file parallel.h
+ * @brief 基于调度器的并行算法
+ */
+
+#ifndef __LIONET_PARALLEL_H__
+#define __LIONET_PARALLEL_H__
+
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "mutex.h"
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace LioNet {
+
+/**
+ * @brief 一次并行调用的共享状态：调度器、粒度、未完成的子区间计数和第一个异常
+ * @details 计数归零时唤醒等待者。等待者是调度器运行的协程时挂起协程，
+ *          工作线程继续运行其他任务；否则阻塞调用线程
+ */
+class ParallelContext : Noncopyable {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] scheduler 运行子区间的调度器
+   * @param[in] grain 不再拆分的区间长度
+   */
+  ParallelContext(Scheduler* scheduler, size_t grain)
+      : m_scheduler(scheduler), m_grain(grain) {}
+
+  Scheduler* getScheduler() const { return m_scheduler; }
+  size_t getGrain() const { return m_grain; }
+
+  /**
+   * @brief 增加 n 个未完成的子区间
+   */
+  void add(size_t n = 1) { m_pending.fetch_add(n, std::memory_order_relaxed); }
+
+  /**
+   * @brief 完成一个子区间，最后一个完成时唤醒等待者
+   */
+  void done();
+
+  /**
+   * @brief 记录异常，只保留第一个；之后还没有开始的区间不再执行
+   */
+  void fail(std::exception_ptr error);
+
+  /**
+   * @brief 是否已经有区间抛出异常
+   */
+  bool failed() const { return m_failed.load(std::memory_order_relaxed); }
+
+  /**
+   * @brief 等待所有子区间完成，有异常时重新抛出第一个
+   */
+  void wait();
+
+ private:
+  /**
+   * @brief 挂起等待的协程后登记为等待者，已经完成时立即重新调度
+   */
+  static void ParkWaiter(Fiber::ptr fiber, void* arg);
+
+ private:
+  Scheduler* m_scheduler;
+  size_t m_grain;
+  std::atomic<size_t> m_pending{0};
+  std::atomic<bool> m_failed{false};
+  // 保护等待者的登记与唤醒，done() 释放锁之后不再访问本对象
+  Spinlock m_mutex;
+  std::exception_ptr m_error;
+  Fiber::ptr m_waiter;
+  Scheduler* m_waiterScheduler = nullptr;
+  Semaphore* m_waiterSem = nullptr;
+};
+
+/**
+ * @brief 拆出去的子区间，调度的任务和拆分它的一方谁先认领谁执行
+ */
+struct ParallelPiece {
+  ParallelPiece(size_t b, size_t e) : begin(b), end(e) {}
+
+  bool claim() { return !claimed.exchange(true, std::memory_order_acq_rel); }
+
+  size_t begin;
+  size_t end;
+  std::atomic<bool> claimed{false};
+};
+
+/**
+ * @brief 递归拆分并执行 [begin, end)
+ * @details 不断把右半部分作为任务交给调度器，工作线程上调度的任务进入本地队列，
+ *          空闲的线程从队列的另一端窃取，先窃取到的是最大的一块。
+ *          执行完最左边的一段后，按从小到大的顺序认领并执行自己拆出、
+ *          还没有被其他线程取走的部分
+ */
+template <class F>
+void ParallelRun(ParallelContext* ctx, const F& body, size_t begin,
+                 size_t end) {
+  std::vector<std::shared_ptr<ParallelPiece> > spawned;
+  while (end - begin > ctx->getGrain()) {
+    size_t mid = begin + (end - begin) / 2;
+    std::shared_ptr<ParallelPiece> piece =
+        std::make_shared<ParallelPiece>(mid, end);
+    ctx->add();
+    ctx->getScheduler()->schedule([ctx, &body, piece] {
+      // 已经被拆分方认领时什么也不做，不再访问 ctx
+      if (piece->claim()) {
+        ParallelRun(ctx, body, piece->begin, piece->end);
+        ctx->done();
+      }
+    });
+    spawned.push_back(std::move(piece));
+    end = mid;
+  }
+  if (!ctx->failed()) {
+    try {
+      body(begin, end);
+    } catch (...) {
+      ctx->fail(std::current_exception());
+    }
+  }
+  for (auto it = spawned.rbegin(); it != spawned.rend(); ++it) {
+    if ((*it)->claim()) {
+      ParallelRun(ctx, body, (*it)->begin, (*it)->end);
+      ctx->done();
+    }
+  }
+}
+
+/**
+ * @brief 返回默认的粒度：每个工作线程大约分到 8 段
+ */
+inline size_t ParallelGrain(Scheduler* scheduler, size_t n) {
+  return std::max<size_t>(1, n / (scheduler->getWorkerCount() * 8));
+}
+
+/**
+ * @brief 在调度器的工作线程上并行执行 body(b, e)，[b, e) 是 [begin, end) 的子区间
+ * @param[in] begin 区间开始
+ * @param[in] end 区间结束
+ * @param[in] grain 不再拆分的区间长度，0 按工作线程数自动选择
+ * @param[in] body 处理一段子区间，可能在任意工作线程上并发调用
+ * @param[in] scheduler 调度器，nullptr 使用当前调度器；都没有时在当前线程串行执行
+ * @details 调用方执行第一段并帮助执行还没有被取走的子区间，剩下的在其他线程上完成前，
+ *          调用协程挂起而不阻塞工作线程（不在调度器协程中时阻塞调用线程）。
+ *          body 抛出的第一个异常在所有已开始的区间结束后重新抛出
+ */
+template <class F>
+void ParallelFor(size_t begin, size_t end, size_t grain, const F& body,
+                 Scheduler* scheduler = nullptr) {
+  if (begin >= end) {
+    return;
+  }
+  if (!scheduler) {
+    scheduler = Scheduler::GetThis();
+  }
+  if (!scheduler) {
+    body(begin, end);
+    return;
+  }
+  if (grain == 0) {
+    grain = ParallelGrain(scheduler, end - begin);
+  }
+  ParallelContext ctx(scheduler, grain);
+  ParallelRun(&ctx, body, begin, end);
+  ctx.wait();
+}
+
+/**
+ * @brief 并行归约
+ * @param[in] identity 归约的初始值
+ * @param[in] map 计算一段子区间的部分结果 T map(b, e)
+ * @param[in] reduce 合并两个部分结果 T reduce(T, T)，需满足结合律
+ * @details 部分结果按区间的顺序合并，reduce 不要求满足交换律。其余参数同 ParallelFor
+ */
+template <class T, class Map, class Reduce>
+T ParallelReduce(size_t begin, size_t end, size_t grain, T identity,
+                 const Map& map, const Reduce& reduce,
+                 Scheduler* scheduler = nullptr) {
+  Spinlock mutex;
+  std::vector<std::pair<size_t, T> > partials;
+  ParallelFor(
+      begin, end, grain,
+      [&mutex, &partials, &map](size_t b, size_t e) {
+        T value = map(b, e);
+        Spinlock::Lock lock(mutex);
+        partials.emplace_back(b, std::move(value));
+      },
+      scheduler);
+  std::sort(partials.begin(), partials.end(),
+            [](const std::pair<size_t, T>& a, const std::pair<size_t, T>& b) {
+              return a.first < b.first;
+            });
+  T result = std::move(identity);
+  for (auto& i : partials) {
+    result = reduce(std::move(result), std::move(i.second));
+  }
+  return result;
+}
+
+/**
+ * @brief 并行执行几个函数，全部完成后返回
+ * @param[in] scheduler 调度器，nullptr 使用当前调度器
+ * @param[in] fs 要执行的函数
+ */
+template <class... Fs>
+void ParallelInvoke(Scheduler* scheduler, Fs&&... fs) {
+  std::function<void()> funcs[] = {
+      std::function<void()>(std::forward<Fs>(fs))...};
+  ParallelFor(
+      0, sizeof...(Fs), 1,
+      [&funcs](size_t b, size_t e) {
+        for (size_t i = b; i < e; ++i) {
+          funcs[i]();
+        }
+      },
+      scheduler);
+}
+
+}  // namespace LioNet
+
+#endif
@@ -1,20 +1,243 @@
 #include "scheduler.h"
+#include <linux/futex.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iterator>
+#include "config.h"
+#include "cpu_topology.h"
 #include "log.h"
 #include "macro.h"
+#include "stack_allocator.h"
+#include "work_stealing_queue.h"
 
 namespace LioNet {
 
 static LioNet::Logger::ptr g_logger = LIONET_LOG_NAME("system");
 
+static ConfigVar<uint32_t>::ptr g_scheduler_inject_capacity =
+    Config::Lookup<uint32_t>("scheduler.inject_capacity", 8192,
+                             "scheduler inject queue capacity (per priority)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_idle_spin_us =
+    Config::Lookup<uint32_t>("scheduler.idle_spin_us", 20,
+                             "scheduler idle spin time before parking (us)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_adaptive_interval_ms =
+    Config::Lookup<uint32_t>("scheduler.adaptive.interval_ms", 10,
+                             "adaptive worker pool evaluation interval (ms)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_adaptive_queue_depth =
+    Config::Lookup<uint32_t>(
+        "scheduler.adaptive.queue_depth", 8,
+        "queued tasks per active worker above which the pool grows");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_adaptive_wait_us =
+    Config::Lookup<uint32_t>(
+        "scheduler.adaptive.wait_us", 1000,
+        "sampled queue wait above which the pool grows (us)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_adaptive_idle_percent =
+    Config::Lookup<uint32_t>(
+        "scheduler.adaptive.idle_percent", 50,
+        "worker idle time above which the pool shrinks (percent)");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_drain_timeout_ms =
+    Config::Lookup<uint32_t>(
+        "scheduler.drain_timeout_ms", 0,
+        "stop() drain timeout before queued tasks are cancelled (ms, 0 = none)");
+
+// 每次休眠前都要读取，缓存配置值
+static std::atomic<uint32_t> s_idle_spin_us{20};
+// 自适应评估时读取
+static std::atomic<uint32_t> s_adaptive_interval_ms{10};
+static std::atomic<uint32_t> s_adaptive_queue_depth{8};
+static std::atomic<uint32_t> s_adaptive_wait_us{1000};
+static std::atomic<uint32_t> s_adaptive_idle_percent{50};
+
+/**
+ * @brief 缓存配置值并在配置变化时更新
+ */
+static void CacheConfig(ConfigVar<uint32_t>::ptr var,
+                        std::atomic<uint32_t>* value) {
+  *value = var->getValue();
+  var->addListener([value](const uint32_t&, const uint32_t& new_value) {
+    *value = new_value;
+  });
+}
+
+struct SchedulerIniter {
+  SchedulerIniter() {
+    CacheConfig(g_scheduler_idle_spin_us, &s_idle_spin_us);
+    CacheConfig(g_scheduler_adaptive_interval_ms, &s_adaptive_interval_ms);
+    CacheConfig(g_scheduler_adaptive_queue_depth, &s_adaptive_queue_depth);
+    CacheConfig(g_scheduler_adaptive_wait_us, &s_adaptive_wait_us);
+    CacheConfig(g_scheduler_adaptive_idle_percent, &s_adaptive_idle_percent);
+  }
+};
+
+static SchedulerIniter __scheduler_init;
+
+/**
+ * @brief *addr 等于 expected 时休眠，timeout 为相对时间，nullptr 不超时
+ */
+static void FutexWait(std::atomic<uint32_t>* addr, uint32_t expected,
+                      const struct timespec* timeout = nullptr) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAIT_PRIVATE,
+          expected, timeout, nullptr, 0);
+}
+
+static void FutexWake(std::atomic<uint32_t>* addr) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(addr), FUTEX_WAKE_PRIVATE, 1,
+          nullptr, nullptr, 0);
+}
+
+static inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#endif
+}
+
 static thread_local Scheduler* t_scheduler = nullptr;
 static thread_local Fiber* t_scheduler_fiber = nullptr;
+// 调度协程切入的协程；发生 yieldTo 后指向实际在运行的协程
+static thread_local Fiber::ptr t_running;
+// 最近一次 yieldTo 让出的协程，回到调度协程时再入队，
+// 如果下一次 yieldTo 的目标正是它则直接切换，不经过队列
+static thread_local Fiber::ptr t_handoff;
+// Park 登记的回调，切回调度协程后执行
+static thread_local void (*t_park_fn)(Fiber::ptr, void*) = nullptr;
+static thread_local void* t_park_arg = nullptr;
+// 当前线程在 t_scheduler 中的工作线程编号，不在 run() 中为 -1
+static thread_local int t_worker = -1;
+// 自适应时入队计数，每 kWaitSampleInterval 个任务记录一次入队时间
+static thread_local uint32_t t_wait_sample = 0;
+
+// 缓存的空闲队列节点上限
+static const size_t kMaxFreeNodes = 4096;
+// 每取这么多次任务先检查一次全局队列和注入队列，
+// 避免本地任务不断时外部提交的任务饿死
+static const uint32_t kGlobalCheckInterval = 61;
+// 一次从全局队列搬到本地队列的任务数上限
+static const size_t kGlobalBatch = 32;
+// 注入队列满时睡眠前让出 CPU 重试的次数
+static const int kInjectYields = 16;
+// 加权轮转中各优先级每一轮可以连续取的任务数
+static const uint32_t kPriorityWeights[Scheduler::kPriorityLevels] = {8, 4, 1};
+// 自适应时采样排队时间的间隔（任务数，2 的幂）
+static const uint32_t kWaitSampleInterval = 64;
+// 自适应时工作线程每取这么多次任务检查一次是否到了评估时间（2 的幂）
+static const uint32_t kAdaptCheckTicks = 16;
+// 有定时器时工作线程每取这么多次任务检查一次是否有到期的定时器（2 的幂）
+static const uint32_t kTimerCheckTicks = 8;
+
+const int Scheduler::kPriorityLevels;
+
+/**
+ * @brief 工作线程的本地运行队列
+ * @details 每个优先级一个队列。只有所属线程入队；出队一律从顶部取（FIFO），
+ *          让出的协程排在已有任务之后，轮转公平，其他线程也从顶部窃取
+ */
+struct Scheduler::Worker {
+  Worker(size_t i, uint32_t s) : index(i), seed(s) {
+    for (int i = 0; i < kPriorityLevels; ++i) {
+      mailboxSize[i] = 0;
+      credits[i] = kPriorityWeights[i];
+    }
+  }
+
+  /**
+   * @brief 取一个空节点，优先使用缓存
+   */
+  FiberAndThread* allocNode() {
+    if (freeNodes.empty()) {
+      return new FiberAndThread();
+    }
+    FiberAndThread* node = freeNodes.back();
+    freeNodes.pop_back();
+    return node;
+  }
+
+  /**
+   * @brief 回收已经移出内容的节点
+   */
+  void releaseNode(FiberAndThread* node) {
+    if (freeNodes.size() < kMaxFreeNodes) {
+      freeNodes.push_back(node);
+    } else {
+      delete node;
+    }
+  }
+
+  /**
+   * @brief 唤醒休眠中的本线程
+   * @pre 已经从休眠栈中移除
+   */
+  void unpark() {
+    wakeup.store(1, std::memory_order_release);
+    FutexWake(&wakeup);
+  }
+
+  /**
+   * @brief xorshift32 随机数，用于选择窃取对象
+   */
+  uint32_t nextRandom() {
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+
+  WorkStealingQueue<FiberAndThread> queue[kPriorityLevels];  // 本地运行队列
+  std::vector<FiberAndThread*> freeNodes;   // 空闲节点，只由所属线程访问
+  size_t index;                             // 在 m_workers 中的编号
+  uint32_t seed;                            // 随机数状态，非零
+  uint32_t ticks = 0;                       // 取任务的次数
+  // 本线程入队、结束的任务数，只由本线程写入，不用原子的读改写；
+  // stopping() 汇总各线程的计数判断是否排空
+  std::atomic<uint64_t> added{0};
+  std::atomic<uint64_t> finished{0};
+  std::atomic<uint32_t> wakeup{0};          // 休眠用的 futex，置 1 表示被唤醒
+  bool parked = false;                      // 是否在休眠栈中，受 m_parkMutex 保护
+  std::atomic<int> l3{-1};  // 绑定的 L3 缓存域，没有绑定或跨域为 -1
+  Spinlock mailboxMutex;                    // 保护 mailbox 与 mailboxFree
+  // 指定在本线程运行的任务，每个优先级一个
+  std::list<FiberAndThread> mailbox[kPriorityLevels];
+  std::list<FiberAndThread> mailboxFree;  // 出队后缓存的空链表节点
+  // mailbox 长度，无锁预判是否为空
+  std::atomic<size_t> mailboxSize[kPriorityLevels];
+  uint32_t credits[kPriorityLevels];  // 本轮加权轮转中各优先级剩余的配额
+  Spinlock deadlineMutex;             // 保护 deadlineHeap
+  std::vector<FiberAndThread> deadlineHeap;  // EDF 最小堆，按截止时间
+  std::atomic<size_t> deadlineSize{0};       // 堆的大小，无锁预判是否为空
+  // 堆顶的截止时间，空堆为 UINT64_MAX，取任务时据此选择最早的堆
+  std::atomic<uint64_t> deadlineTop{UINT64_MAX};
+  // 停用后休眠中，唤醒方置为 false 后 unpark()
+  std::atomic<bool> retired{false};
+  // 自适应时本次空闲的开始时间（微秒），不在空闲中为 0；评估时把已经计入的部分前移
+  std::atomic<uint64_t> idleStart{0};
+
+  /**
+   * @brief 堆的比较函数，截止时间晚的排在后面
+   */
+  static bool Later(const FiberAndThread& a, const FiberAndThread& b) {
+    return a.deadline > b.deadline;
+  }
+};
 
 Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
     : m_name(name) {
   LIONET_ASSERT(threads > 0);
+  m_drainTimeoutMs = g_scheduler_drain_timeout_ms->getValue();
+  uint32_t capacity = g_scheduler_inject_capacity->getValue();
+  for (int i = 0; i < kPriorityLevels; ++i) {
+    m_inject[i] = new MPMCQueue<FiberAndThread>(capacity);
+  }
 
   if (use_caller) {
-    LioNet::Fiber::GetThis();
+    LioNet::Fiber::Current();
     --threads;
 
     LIONET_ASSERT(GetThis() == nullptr);
@@ -31,13 +254,44 @@ Scheduler::Scheduler(size_t threads, bool use_caller, const std::string& name)
   }
 
   m_threadCount = threads;
+  size_t workers = threads + (use_caller ? 1 : 0);
+  for (size_t i = 0; i < workers; ++i) {
+    m_workers.push_back(
+        new Worker(i, static_cast<uint32_t>((i + 1) * 2654435761u)));
+  }
+  m_parked.reserve(workers);
+  m_activeWorkers = workers;
+
+  size_t slots = 1;
+  while (slots < workers * 2) {
+    slots <<= 1;
+  }
+  m_workerSlots.reset(new std::atomic<uint64_t>[slots]);
+  for (size_t i = 0; i < slots; ++i) {
+    m_workerSlots[i].store(0, std::memory_order_relaxed);
+  }
+  m_workerMask = slots - 1;
 }
 
 Scheduler::~Scheduler() {
-  LIONET_ASSERT(m_stopping);
+  LIONET_ASSERT(m_stopping.load(std::memory_order_acquire));
   if (GetThis() == this) {
     t_scheduler = nullptr;
   }
+  for (auto w : m_workers) {
+    for (auto& queue : w->queue) {
+      while (FiberAndThread* node = queue.pop()) {
+        delete node;
+      }
+    }
+    for (auto node : w->freeNodes) {
+      delete node;
+    }
+    delete w;
+  }
+  for (auto queue : m_inject) {
+    delete queue;
+  }
 }
 
 Scheduler* Scheduler::GetThis() {
@@ -51,27 +305,92 @@ Fiber* Scheduler::GetMainFiber() {
 void Scheduler::start() {
   MutexType::Lock lock(m_mutex);
 
-  if (!m_stopping) {
+  if (!m_stopping.load(std::memory_order_acquire)) {
     return;
   }
 
-  m_stopping = false;
+  m_stopping.store(false, std::memory_order_release);
   LIONET_ASSERT(m_threads.empty());
+  m_nextWorker = 0;
+  // 上一次运行的线程已经退出，线程id可能被复用
+  for (size_t i = 0; i <= m_workerMask; ++i) {
+    m_workerSlots[i].store(0, std::memory_order_relaxed);
+  }
+  m_cancelling = false;
+  m_drainDeadline = 0;
+  if (m_adaptive) {
+    m_activeWorkers = m_minWorkers;
+    m_adaptLast = LioNet::GetCurrentUS();
+    m_idleUs = 0;
+    m_waitSum = 0;
+    m_waitCount = 0;
+  }
 
   m_threads.resize(m_threadCount);
   for (size_t i = 0; i < m_threadCount; ++i) {
     m_threads[i].reset(new Thread(std::bind(&Scheduler::run, this),
-                                  m_name + "_" + std::to_string(i)));
+                                  m_name + "_" + std::to_string(i),
+                                  placeCpus(i)));
     m_threadIds.push_back(m_threads[i]->getId());
   }
 }
 
-void Scheduler::stop() {
-  m_autoStop = true;
+std::vector<int> Scheduler::placeCpus(size_t index) const {
+  if (m_placement == PLACEMENT_LIST) {
+    if (m_placementCpus.empty()) {
+      return std::vector<int>();
+    }
+    return std::vector<int>(1, m_placementCpus[index % m_placementCpus.size()]);
+  }
+  const CpuTopology* topo = CpuTopology::GetInstance();
+  const std::vector<CpuTopology::Cpu>& cpus = topo->getCpus();
+  if (m_placement == PLACEMENT_NONE || cpus.empty()) {
+    return std::vector<int>();
+  }
+  if (m_placement == PLACEMENT_COMPACT) {
+    return std::vector<int>(1, cpus[index % cpus.size()].id);
+  }
+  int l3 = static_cast<int>(index % topo->getL3Count());
+  if (m_placement == PLACEMENT_L3) {
+    return topo->getL3Cpus(l3);
+  }
+  // PLACEMENT_SCATTER：域内先取每个核的第一个超线程，再取第二个
+  std::vector<CpuTopology::Cpu> domain;
+  for (auto& i : cpus) {
+    if (i.l3 == l3) {
+      domain.push_back(i);
+    }
+  }
+  std::vector<int> order;
+  for (size_t sibling = 0; order.size() < domain.size(); ++sibling) {
+    for (size_t i = 0; i < domain.size(); ++i) {
+      size_t rank = 0;
+      for (size_t j = 0; j < i; ++j) {
+        if (domain[j].package == domain[i].package &&
+            domain[j].core == domain[i].core) {
+          ++rank;
+        }
+      }
+      if (rank == sibling) {
+        order.push_back(domain[i].id);
+      }
+    }
+  }
+  size_t slot = index / topo->getL3Count();
+  return std::vector<int>(1, order[slot % order.size()]);
+}
+
+void Scheduler::stop(DrainMode mode) {
+  m_autoStop.store(true, std::memory_order_release);
+  if (mode == DRAIN_CANCEL) {
+    m_cancelling = true;
+  } else if (m_drainTimeoutMs > 0) {
+    m_drainDeadline = LioNet::GetCurrentUS() + m_drainTimeoutMs * 1000;
+  }
   if (m_rootFiber && m_threadCount == 0 &&
       (m_rootFiber->getState() == Fiber::TERM ||
        m_rootFiber->getState() == Fiber::INIT)) {
-    m_stopping = true;
+    m_stopping.store(true, std::memory_order_release);
 
     if (stopping()) {
       return;
@@ -84,14 +403,13 @@ void Scheduler::stop() {
     LIONET_ASSERT(GetThis() != this);
   }
 
-  m_stopping = true;
-  for (size_t i = 0; i < m_threadCount; ++i) {
-    tickle();
-  }
-
-  if (m_rootFiber) {
-    tickle();
+  m_stopping.store(true, std::memory_order_release);
+  if (m_adaptive) {
+    // 停用的线程也要参与清空队列并退出
+    setActiveWorkers(m_workers.size());
   }
+  // 休眠的线程醒来取走剩下的任务或者退出；之后的休眠由排空时最后一个任务唤醒
+  wakeAll();
 
   if (m_rootFiber) {
     if (!stopping()) {
@@ -108,6 +426,10 @@ void Scheduler::stop() {
   for (auto& i : thrs) {
     i->join();
   }
+  if (m_cancelled > 0) {
+    LIONET_INFO(g_logger) << "scheduler " << m_name << " stopped, cancelled "
+                          << m_cancelled << " queued tasks";
+  }
 }
 
 void Scheduler::setThis() {
@@ -120,7 +442,21 @@ void Scheduler::run() {
   setThis();
   // 设置当前线程的主协程
   if (LioNet::GetThreadId() != m_rootThread) {
-    t_scheduler_fiber = Fiber::GetThis().get();
+    t_scheduler_fiber = Fiber::Current();
+  }
+  // use_caller 的调用线程固定使用最后一个编号，自适应只停用编号大的线程
+  size_t index = LioNet::GetThreadId() == m_rootThread ? m_threadCount
+                                                        : m_nextWorker++;
+  LIONET_ASSERT(index < m_workers.size());
+  t_worker = static_cast<int>(index);
+  Worker* worker = m_workers[index];
+  registerWorker(worker, LioNet::GetThreadId());
+  if (Thread::GetThis() && !Thread::GetThis()->getCpus().empty()) {
+    // 绑定到一个节点的线程从本节点分配协程栈
+    const std::vector<int>& cpus = Thread::GetThis()->getCpus();
+    const CpuTopology* topo = CpuTopology::GetInstance();
+    worker->l3.store(topo->getL3(cpus), std::memory_order_relaxed);
+    PooledStackAllocator::SetThreadNode(topo->getNode(cpus));
   }
 
   Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
@@ -130,72 +466,58 @@ void Scheduler::run() {
   while (true) {
     ft.reset();
     bool tickle_me = false;
-    bool is_active = false;
-
-    {
-      MutexType::Lock lock(m_mutex);
-      auto it = m_fibers.begin();
-      while (it != m_fibers.end()) {
-        if (it->thread != -1 && it->thread != LioNet::GetThreadId()) {
-          ++it;
-          tickle_me = true;
-          continue;
-        }
-        LIONET_ASSERT(it->fiber || it->func);
-        if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
-          ++it;
-          continue;
-        }
-
-        ft = *it;
-        it = m_fibers.erase(it);
-        ++m_activeThreadCount;
-        is_active = true;
-        break;
+    bool is_active = true;
+    if (LIONET_UNLIKELY(worker->index >=
+                        m_activeWorkers.load(std::memory_order_relaxed))) {
+      if (!takeRetired(worker, ft)) {
+        continue;
       }
-      tickle_me |= it != m_fibers.end();
+    } else {
+      is_active = takeTask(worker, ft, tickle_me);
     }
 
     if (tickle_me) {
       tickle();
     }
+    if (LIONET_UNLIKELY(m_stopping.load(std::memory_order_acquire)) &&
+        is_active && cancelTask(ft)) {
+      --m_activeThreadCount;
+      continue;
+    }
+    if (LIONET_UNLIKELY(ft.enqueued != 0)) {
+      uint64_t now = LioNet::GetCurrentUS();
+      m_waitSum.fetch_add(now > ft.enqueued ? now - ft.enqueued : 0,
+                          std::memory_order_relaxed);
+      m_waitCount.fetch_add(1, std::memory_order_relaxed);
+    }
 
     if (ft.fiber && (ft.fiber->getState() != Fiber::TERM &&
                      ft.fiber->getState() != Fiber::EXCEPT)) {
-      ft.fiber->swapIn();
-      --m_activeThreadCount;
-
-      if (ft.fiber->getState() == Fiber::READY ||
-          ft.fiber->getState() == Fiber::HOLD) {
-        schedule(ft.fiber);
-      } else if (ft.fiber->getState() != Fiber::TERM &&
-                 ft.fiber->getState() != Fiber::EXCEPT) {
-        ft.fiber->m_state = Fiber::HOLD;
-      }
+      resume(std::move(ft.fiber));
       ft.reset();
     } else if (ft.func) {
       if (func_fiber) {
-        func_fiber->reset(ft.func);
+        func_fiber->reset(std::move(ft.func));
       } else {
-        func_fiber.reset(new Fiber(ft.func));
+        func_fiber.reset(
+            new Fiber(std::move(ft.func), 0, false, m_sharedStack));
       }
+      // 函数中让出后按任务的优先级和截止时间重新入队
+      func_fiber->m_priority = ft.priority;
+      func_fiber->m_deadline = ft.deadline;
       ft.reset();
 
-      func_fiber->swapIn();
-      --m_activeThreadCount;
-      if (func_fiber->getState() == Fiber::READY ||
-          func_fiber->getState() == Fiber::HOLD) {
-        schedule(func_fiber);
-        func_fiber.reset();
-      } else if (func_fiber->getState() == Fiber::EXCEPT ||
-                 func_fiber->getState() == Fiber::TERM) {
-        func_fiber->reset(nullptr);
-      } else {
-        func_fiber->m_state = Fiber::HOLD;
-        func_fiber.reset();
+      // 执行结束的是这个函数协程本身时才复用
+      Fiber* started = func_fiber.get();
+      Fiber::ptr done = resume(std::move(func_fiber));
+      if (done && done.get() == started) {
+        done->reset(nullptr);
+        func_fiber = std::move(done);
       }
     } else {
       if (is_active) {
+        // 取到的是已经结束的协程
+        finishTasks();
         --m_activeThreadCount;
         continue;
       }
@@ -214,25 +536,1097 @@ void Scheduler::run() {
       }
     }
   }
+  // 依次唤醒其他休眠的工作线程，让它们也看到停止。要在最后一次取任务减少活跃计数之后：
+  // 其他线程登记休眠后检查 stopping() 时可能恰好看到本线程的活跃计数而继续休眠
+  tickle();
+  t_worker = -1;
+}
+
+Scheduler::Worker* Scheduler::getLocalWorker() const {
+  if (t_worker < 0 || t_scheduler != this) {
+    return nullptr;
+  }
+  return m_workers[t_worker];
+}
+
+void Scheduler::enqueue(FiberAndThread&& ft) {
+  LIONET_ASSERT(ft.priority >= 0 && ft.priority < kPriorityLevels);
+  // 先计数再入队：出队的一方与入队同步，任务的结束计数总在这次入队计数之后
+  Worker* w = getLocalWorker();
+  if (w) {
+    w->added.store(w->added.load(std::memory_order_relaxed) + 1,
+                   std::memory_order_relaxed);
+  } else {
+    m_added.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (m_adaptive && (++t_wait_sample & (kWaitSampleInterval - 1)) == 0) {
+    ft.enqueued = LioNet::GetCurrentUS();
+  }
+  if (ft.deadline && ft.thread == -1 && m_policy == POLICY_EDF) {
+    if (!w) {
+      w = m_workers[m_nextDeadline++ % m_workers.size()];
+    }
+    pushDeadline(w, std::move(ft));
+    return;
+  }
+  if (w && ft.thread == -1) {
+    if (ft.fiber) {
+      ft.fiber->m_queueState.store(Fiber::QUEUED,
+                                   std::memory_order_release);
+    }
+    FiberAndThread* node = w->allocNode();
+    *node = std::move(ft);
+    w->queue[node->priority].push(node);
+    notifyIdle();
+    return;
+  }
+
+  if (ft.thread == -1) {
+    if (ft.fiber) {
+      ft.fiber->m_queueState.store(Fiber::QUEUED, std::memory_order_release);
+    }
+    if (!m_inject[ft.priority]->tryPush(std::move(ft))) {
+      injectSlow(std::move(ft));
+    }
+    notifyIdle();
+    return;
+  }
+
+  // 指定线程的任务直接投递到该线程的邮箱；线程还没有开始运行时先放入全局队列，
+  // 由它启动后或其他工作线程转投
+  Worker* owner = findWorker(ft.thread);
+  if (owner) {
+    postMailbox(owner, std::move(ft));
+    return;
+  }
+
+  bool need_tickle = false;
+  {
+    MutexType::Lock lock(m_mutex);
+    need_tickle = scheduleNonLock(std::move(ft));
+  }
+  if (need_tickle) {
+    tickle();
+  }
+}
+
+Scheduler::Worker* Scheduler::findWorker(int thread) const {
+  uint32_t key = static_cast<uint32_t>(thread);
+  // 线性探测，表中至少一半是空槽
+  for (size_t i = key & m_workerMask;; i = (i + 1) & m_workerMask) {
+    uint64_t entry = m_workerSlots[i].load(std::memory_order_acquire);
+    if (entry == 0) {
+      return nullptr;
+    }
+    if (entry >> 32 == key) {
+      return m_workers[(entry & 0xFFFFFFFFu) - 1];
+    }
+  }
+}
+
+void Scheduler::registerWorker(Worker* w, int thread) {
+  uint32_t key = static_cast<uint32_t>(thread);
+  uint64_t entry = static_cast<uint64_t>(key) << 32 | (w->index + 1);
+  for (size_t i = key & m_workerMask;; i = (i + 1) & m_workerMask) {
+    uint64_t expected = 0;
+    if (m_workerSlots[i].compare_exchange_strong(
+            expected, entry, std::memory_order_release)) {
+      return;
+    }
+  }
+}
+
+void Scheduler::postMailbox(Worker* w, FiberAndThread&& ft) {
+  if (ft.fiber) {
+    ft.fiber->m_queueState.store(Fiber::QUEUED, std::memory_order_release);
+  }
+  int level = ft.priority;
+  {
+    Spinlock::Lock lock(w->mailboxMutex);
+    std::list<FiberAndThread>& mailbox = w->mailbox[level];
+    if (w->mailboxFree.empty()) {
+      mailbox.push_back(std::move(ft));
+    } else {
+      mailbox.splice(mailbox.end(), w->mailboxFree, w->mailboxFree.begin());
+      mailbox.back() = std::move(ft);
+    }
+    ++w->mailboxSize[level];
+  }
+  wakeWorker(w);
+}
+
+bool Scheduler::takeMailbox(Worker* w, int level, FiberAndThread& ft) {
+  std::list<FiberAndThread>& mailbox = w->mailbox[level];
+  while (w->mailboxSize[level].load(std::memory_order_relaxed) > 0) {
+    {
+      Spinlock::Lock lock(w->mailboxMutex);
+      if (mailbox.empty()) {
+        return false;
+      }
+      ft = std::move(mailbox.front());
+      if (w->mailboxFree.size() < kMaxFreeNodes) {
+        w->mailboxFree.splice(w->mailboxFree.end(), mailbox, mailbox.begin());
+      } else {
+        mailbox.pop_front();
+      }
+      --w->mailboxSize[level];
+    }
+    if (!ClaimFiber(ft.fiber.get())) {
+      ft.reset();
+      finishTasks();
+      continue;
+    }
+    if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+      // 在运行中被调度、还没有切出的协程，放回邮箱稍后再取
+      postMailbox(w, std::move(ft));
+      ft.reset();
+      return false;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool Scheduler::ClaimFiber(Fiber* fiber) {
+  if (!fiber) {
+    return true;
+  }
+  int expected = Fiber::QUEUED;
+  return fiber->m_queueState.compare_exchange_strong(
+      expected, Fiber::CLAIMED, std::memory_order_acq_rel);
+}
+
+void Scheduler::injectSlow(FiberAndThread&& ft) {
+  // 没有正在运行的其他工作线程时等待不到消费者
+  if (m_threadCount == 0 || m_stopping.load(std::memory_order_acquire)) {
+    MutexType::Lock lock(m_mutex);
+    scheduleNonLock(std::move(ft));
+    return;
+  }
+  MPMCQueue<FiberAndThread>* inject = m_inject[ft.priority];
+  // 先让出 CPU 给工作线程消费，多数情况下不必睡眠
+  for (int i = 0; i < kInjectYields; ++i) {
+    sched_yield();
+    if (inject->tryPush(std::move(ft))) {
+      return;
+    }
+  }
+  while (true) {
+    // 先登记再重试：消费者出队后检查登记数，两边之间有全序屏障，不会漏掉通知
+    m_injectWaiters.fetch_add(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (inject->tryPush(std::move(ft))) {
+      // 撤销登记；已经被消费者扣除时会多收到一次通知，等待方重试即可
+      size_t waiters = m_injectWaiters.load(std::memory_order_relaxed);
+      while (waiters > 0 &&
+             !m_injectWaiters.compare_exchange_weak(waiters, waiters - 1)) {
+      }
+      return;
+    }
+    // 任意优先级的队列出队都会通知，醒来后重试自己的队列
+    m_injectNotFull.wait();
+    if (inject->tryPush(std::move(ft))) {
+      return;
+    }
+    if (m_stopping.load(std::memory_order_acquire)) {
+      MutexType::Lock lock(m_mutex);
+      scheduleNonLock(std::move(ft));
+      return;
+    }
+  }
+}
+
+bool Scheduler::takeInjected(Worker* w, int level, FiberAndThread& ft) {
+  MPMCQueue<FiberAndThread>* inject = m_inject[level];
+  if (inject->empty()) {
+    return false;
+  }
+  // 按工作线程数均分，剩下的留给其他线程
+  size_t max = std::min(kGlobalBatch, inject->size() / m_workers.size()) + 1;
+  FiberAndThread batch[kGlobalBatch + 1];
+  size_t n = inject->tryPopBulk(batch, max);
+  if (n == 0) {
+    return false;
+  }
+
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  size_t waiters = m_injectWaiters.load(std::memory_order_relaxed);
+  for (size_t i = 0; i < n && waiters > 0; ++i) {
+    if (m_injectWaiters.compare_exchange_weak(waiters, waiters - 1)) {
+      m_injectNotFull.notify();
+      waiters = m_injectWaiters.load(std::memory_order_relaxed);
+    }
+  }
+
+  bool taken = false;
+  for (size_t i = 0; i < n; ++i) {
+    if (taken) {
+      FiberAndThread* node = w->allocNode();
+      *node = std::move(batch[i]);
+      w->queue[level].push(node);
+      continue;
+    }
+    if (!ClaimFiber(batch[i].fiber.get())) {
+      // 已被 yieldTo 认领的过期项
+      batch[i].reset();
+      finishTasks();
+      continue;
+    }
+    if (batch[i].fiber && batch[i].fiber->getState() == Fiber::EXEC) {
+      // 在运行中被调度、还没有切出的协程，放回全局队列稍后再取
+      MutexType::Lock lock(m_mutex);
+      scheduleNonLock(std::move(batch[i]));
+      batch[i].reset();
+      continue;
+    }
+    ft = std::move(batch[i]);
+    taken = true;
+  }
+  return taken;
+}
+
+void Scheduler::notifyIdle() {
+  // 入队在前、读取空闲线程数在后，与工作线程先计入空闲再检查队列配对
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (hasIdleThreads()) {
+    tickle();
+  }
+}
+
+void Scheduler::wakeAll() {
+  // 与 tickle() 相同，修改在前、检查休眠在后
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_parkedCount.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  std::vector<Worker*> parked;
+  {
+    Spinlock::Lock lock(m_parkMutex);
+    parked.assign(m_parked.begin(), m_parked.end());
+    m_parked.clear();
+    for (auto w : parked) {
+      w->parked = false;
+    }
+    m_parkedCount = 0;
+  }
+  for (auto w : parked) {
+    w->unpark();
+  }
+}
+
+void Scheduler::finishTasks(size_t n) {
+  Worker* w = getLocalWorker();
+  if (w) {
+    w->finished.store(w->finished.load(std::memory_order_relaxed) + n,
+                      std::memory_order_release);
+  } else {
+    m_finished.fetch_add(n, std::memory_order_release);
+  }
+  if (LIONET_UNLIKELY(m_stopping.load(std::memory_order_acquire)) &&
+      stopping()) {
+    // 停止中最后一个任务结束，一次唤醒所有休眠的线程退出，不再逐个传递
+    wakeAll();
+  }
+}
+
+uint64_t Scheduler::inflight() const {
+  // 先汇总结束数、再汇总入队数。读到的结束数对应的入队计数在这之前已经可见，
+  // 差值不会偏小；差为 0 时，读完结束数的时刻之前入队的任务都已经结束
+  uint64_t finished = m_finished.load(std::memory_order_acquire);
+  for (auto w : m_workers) {
+    finished += w->finished.load(std::memory_order_acquire);
+  }
+  uint64_t added = m_added.load(std::memory_order_relaxed);
+  for (auto w : m_workers) {
+    added += w->added.load(std::memory_order_relaxed);
+  }
+  return added - finished;
+}
+
+bool Scheduler::cancelling() {
+  if (m_cancelling.load(std::memory_order_relaxed)) {
+    return true;
+  }
+  uint64_t deadline = m_drainDeadline.load(std::memory_order_relaxed);
+  if (deadline == 0 || LioNet::GetCurrentUS() < deadline) {
+    return false;
+  }
+  if (!m_cancelling.exchange(true)) {
+    LIONET_WARN(g_logger) << "scheduler " << m_name
+                          << " drain timeout, cancel queued tasks and timers";
+  }
+  return true;
+}
+
+bool Scheduler::cancelTask(FiberAndThread& ft) {
+  if (!cancelling()) {
+    return false;
+  }
+  // 已经开始的协程运行到结束或挂起，不丢弃
+  if (ft.fiber && ft.fiber->getState() != Fiber::INIT) {
+    return false;
+  }
+  if (ft.fiber) {
+    ft.fiber->m_queueState.store(Fiber::NOT_QUEUED, std::memory_order_release);
+  }
+  // 任务的析构中调度的任务先计数，之后才结束这一个
+  ft.reset();
+  ++m_cancelled;
+  finishTasks();
+  return true;
+}
+
+bool Scheduler::scheduleNonLock(FiberAndThread&& ft) {
+  bool need_tickle = m_fibers.empty();
+  if (ft.fiber) {
+    ft.fiber->m_queueState.store(Fiber::QUEUED,
+                                 std::memory_order_release);
+  }
+  // 优先复用已出队的链表节点，稳定状态下入队不分配内存
+  if (m_freeNodes.empty()) {
+    m_fibers.push_back(std::move(ft));
+  } else {
+    m_fibers.splice(m_fibers.end(), m_freeNodes, m_freeNodes.begin());
+    m_fibers.back() = std::move(ft);
+  }
+  m_globalSize.fetch_add(1, std::memory_order_relaxed);
+  return need_tickle;
+}
+
+bool Scheduler::takeTask(Worker* w, FiberAndThread& ft, bool& tickle_me) {
+  // 先计入活跃线程：任务离开队列到开始运行之间 stopping() 不会误判为空
+  ++m_activeThreadCount;
+  ++w->ticks;
+  if (m_adaptive && (w->ticks & (kAdaptCheckTicks - 1)) == 0) {
+    adaptWorkers();
+  }
+  if ((w->ticks & (kTimerCheckTicks - 1)) == 0 && hasTimer()) {
+    processTimers();
+  }
+  bool global_first = w->ticks % kGlobalCheckInterval == 0;
+  if (global_first) {
+    if (takeGlobal(w, ft, tickle_me)) {
+      return true;
+    }
+    // 注入队列平时只在本地队列为空时才取，同样定期先取一次
+    for (int level = 0; level < kPriorityLevels; ++level) {
+      if (takeInjected(w, level, ft)) {
+        return true;
+      }
+    }
+  }
+  // 带截止时间的任务最先运行；定期让其他队列先取一次，EDF 任务持续过载时它们也不会饿死
+  bool edf = m_policy == POLICY_EDF;
+  if (edf && !global_first && takeDeadline(ft)) {
+    return true;
+  }
+  // 加权轮转：从高到低取，每取一个扣一次该级本轮的配额，配额用完的级别让给低优先级；
+  // 有配额的级别都没有任务时开始新一轮，持续有高优先级任务时低优先级每轮也能取到
+  unsigned skipped = 0;
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    if (w->credits[level] == 0) {
+      skipped |= 1u << level;
+    } else if (takeLevel(w, level, ft)) {
+      --w->credits[level];
+      return true;
+    }
+  }
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    w->credits[level] = kPriorityWeights[level];
+  }
+  for (int level = 0; skipped && level < kPriorityLevels; ++level) {
+    if ((skipped & (1u << level)) && takeLevel(w, level, ft)) {
+      --w->credits[level];
+      return true;
+    }
+  }
+  if (edf && global_first && takeDeadline(ft)) {
+    return true;
+  }
+  if (!global_first && takeGlobal(w, ft, tickle_me)) {
+    return true;
+  }
+  // 本线程没有任务时才窃取，同样先取高优先级
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    if (stealTask(w, level, ft)) {
+      return true;
+    }
+  }
+  --m_activeThreadCount;
+  return false;
+}
+
+void Scheduler::pushDeadline(Worker* w, FiberAndThread&& ft) {
+  if (ft.fiber) {
+    ft.fiber->m_queueState.store(Fiber::QUEUED, std::memory_order_release);
+  }
+  {
+    Spinlock::Lock lock(w->deadlineMutex);
+    std::vector<FiberAndThread>& heap = w->deadlineHeap;
+    heap.push_back(std::move(ft));
+    std::push_heap(heap.begin(), heap.end(), &Worker::Later);
+    w->deadlineTop.store(heap.front().deadline, std::memory_order_relaxed);
+    ++w->deadlineSize;
+  }
+  notifyIdle();
+}
+
+bool Scheduler::takeDeadline(FiberAndThread& ft) {
+  while (true) {
+    // 每个堆只保证自己有序，按堆顶选择截止时间最早的一个
+    Worker* best = nullptr;
+    uint64_t earliest = UINT64_MAX;
+    for (auto w : m_workers) {
+      uint64_t top = w->deadlineTop.load(std::memory_order_relaxed);
+      if (top < earliest) {
+        earliest = top;
+        best = w;
+      }
+    }
+    if (!best) {
+      return false;
+    }
+    if (popDeadline(best, ft)) {
+      return true;
+    }
+  }
+}
+
+bool Scheduler::popDeadline(Worker* w, FiberAndThread& ft) {
+  while (w->deadlineSize.load(std::memory_order_relaxed) > 0) {
+    {
+      Spinlock::Lock lock(w->deadlineMutex);
+      std::vector<FiberAndThread>& heap = w->deadlineHeap;
+      if (heap.empty()) {
+        return false;
+      }
+      std::pop_heap(heap.begin(), heap.end(), &Worker::Later);
+      ft = std::move(heap.back());
+      heap.pop_back();
+      w->deadlineTop.store(heap.empty() ? UINT64_MAX : heap.front().deadline,
+                           std::memory_order_relaxed);
+      --w->deadlineSize;
+    }
+    if (!ClaimFiber(ft.fiber.get())) {
+      // 已被 yieldTo 认领的过期项
+      ft.reset();
+      finishTasks();
+      continue;
+    }
+    if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+      // 在运行中被调度、还没有切出的协程，放回全局队列稍后再取
+      MutexType::Lock lock(m_mutex);
+      scheduleNonLock(std::move(ft));
+      ft.reset();
+      continue;
+    }
+    if (m_deadlineMiss && ft.deadline < LioNet::GetCurrentUS()) {
+      ++m_deadlineDropped;
+      if (ft.fiber) {
+        // 交给回调后可能被重新调度
+        ft.fiber->m_queueState.store(Fiber::NOT_QUEUED,
+                                     std::memory_order_release);
+      }
+      m_deadlineMiss(std::move(ft.fiber), ft.func, ft.deadline);
+      ft.reset();
+      // 回调中重新调度的协程已经重新计数
+      finishTasks();
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+bool Scheduler::takeLevel(Worker* w, int level, FiberAndThread& ft) {
+  // 邮箱与本地队列轮流优先，任何一边持续有任务时另一边也不会饿死
+  bool mailbox_first = w->ticks & 1;
+  if (mailbox_first && takeMailbox(w, level, ft)) {
+    return true;
+  }
+  WorkStealingQueue<FiberAndThread>& queue = w->queue[level];
+  while (!queue.empty()) {
+    FiberAndThread* node = queue.steal();
+    if (node && claimNode(w, node, ft)) {
+      return true;
+    }
+  }
+  if (!mailbox_first && takeMailbox(w, level, ft)) {
+    return true;
+  }
+  return takeInjected(w, level, ft);
+}
+
+bool Scheduler::takeGlobal(Worker* w, FiberAndThread& ft, bool& tickle_me) {
+  if (m_globalSize.load(std::memory_order_relaxed) == 0) {
+    return false;
+  }
+
+  // 移动出队，不修改协程引用计数；空节点留给下次入队复用
+  auto remove = [this](std::list<FiberAndThread>::iterator it)
+      -> std::list<FiberAndThread>::iterator {
+    m_globalSize.fetch_sub(1, std::memory_order_relaxed);
+    if (m_freeNodes.size() < kMaxFreeNodes) {
+      auto next = std::next(it);
+      m_freeNodes.splice(m_freeNodes.end(), m_fibers, it);
+      return next;
+    }
+    return m_fibers.erase(it);
+  };
+
+  int tid = LioNet::GetThreadId();
+  bool taken = false;
+  size_t moved = 0;
+  MutexType::Lock lock(m_mutex);
+  // 按工作线程数均分，剩下的留给其他线程
+  size_t limit = std::min(kGlobalBatch, m_globalSize / m_workers.size());
+  auto it = m_fibers.begin();
+  while (it != m_fibers.end()) {
+    if (it->thread != -1 && it->thread != tid) {
+      // 目标线程已经开始运行，转投到它的邮箱，之后不再重复扫描
+      Worker* owner = findWorker(it->thread);
+      if (owner) {
+        postMailbox(owner, std::move(*it));
+        it = remove(it);
+      } else {
+        ++it;
+        tickle_me = true;
+      }
+      continue;
+    }
+    LIONET_ASSERT(it->fiber || it->func);
+    if (it->fiber && it->fiber->getState() == Fiber::EXEC) {
+      ++it;
+      continue;
+    }
+
+    if (!taken) {
+      if (!ClaimFiber(it->fiber.get())) {
+        // 已被 yieldTo 认领的过期项
+        it = remove(it);
+        finishTasks();
+        continue;
+      }
+      ft = std::move(*it);
+      taken = true;
+    } else if (moved >= limit) {
+      break;
+    } else if (it->thread == -1) {
+      FiberAndThread* node = w->allocNode();
+      *node = std::move(*it);
+      w->queue[node->priority].push(node);
+      ++moved;
+    } else {
+      ++it;
+      continue;
+    }
+    it = remove(it);
+  }
+  tickle_me |= it != m_fibers.end();
+  return taken;
+}
+
+bool Scheduler::stealTask(Worker* w, int level, FiberAndThread& ft) {
+  size_t n = m_workers.size();
+  if (n < 2) {
+    return false;
+  }
+  size_t start = w->nextRandom() % n;
+  int l3 = w->l3.load(std::memory_order_relaxed);
+  // 绑定了 L3 域时先窃取同一个域的线程，任务的数据多半还在共享的缓存里
+  for (size_t i = 0; i < (l3 < 0 ? n : 2 * n); ++i) {
+    Worker* victim = m_workers[(start + i) % n];
+    if (victim == w) {
+      continue;
+    }
+    if (l3 >= 0 &&
+        (victim->l3.load(std::memory_order_relaxed) == l3) != (i < n)) {
+      continue;
+    }
+    WorkStealingQueue<FiberAndThread>& queue = victim->queue[level];
+    while (!queue.empty()) {
+      FiberAndThread* node = queue.steal();
+      if (node && claimNode(w, node, ft)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+bool Scheduler::claimNode(Worker* w, FiberAndThread* node,
+                          FiberAndThread& ft) {
+  ft = std::move(*node);
+  w->releaseNode(node);
+  if (!ClaimFiber(ft.fiber.get())) {
+    // 已被 yieldTo 认领的过期项
+    ft.reset();
+    finishTasks();
+    return false;
+  }
+  if (ft.fiber && ft.fiber->getState() == Fiber::EXEC) {
+    // 在运行中被调度、还没有切出的协程，放回全局队列稍后再取
+    MutexType::Lock lock(m_mutex);
+    scheduleNonLock(std::move(ft));
+    ft.reset();
+    return false;
+  }
+  return true;
+}
+
+Fiber::ptr Scheduler::resume(Fiber::ptr fiber) {
+  t_running = std::move(fiber);
+  t_running->swapIn();
+  Fiber::ptr back = std::move(t_running);
+  back->m_queueState.store(Fiber::NOT_QUEUED, std::memory_order_release);
+
+  if (t_handoff) {
+    schedule(std::move(t_handoff));
+  }
+  if (t_park_fn) {
+    // 登记之后协程可能立即在其他线程恢复，不能再访问它的状态
+    void (*fn)(Fiber::ptr, void*) = t_park_fn;
+    t_park_fn = nullptr;
+    fn(std::move(back), t_park_arg);
+  } else if (back->getState() == Fiber::READY ||
+             back->getState() == Fiber::HOLD) {
+    schedule(std::move(back));
+  } else if (back->getState() != Fiber::TERM &&
+             back->getState() != Fiber::EXCEPT) {
+    back->m_state = Fiber::HOLD;
+    back.reset();
+  }
+  // 重新入队之后再结束本次任务，stopping() 不会在协程重新入队之前看到排空
+  --m_activeThreadCount;
+  finishTasks();
+  return back;
+}
+
+void Scheduler::yieldTo(Fiber::ptr target) {
+  Fiber* cur = Fiber::Current();
+  LIONET_ASSERT(GetThis() == this);
+  LIONET_ASSERT2(t_running.get() == cur,
+                 "yieldTo must be called from a fiber run by the scheduler");
+  LIONET_ASSERT(target && target.get() != cur);
+
+  // 共享栈之间直接切换会覆盖自己正在使用的栈，绑定到其他线程的协程也不能在这里运行，
+  // 这两种情况交给调度器
+  int bound = target->getBoundThread();
+  if ((cur->isSharedStack() && target->isSharedStack()) ||
+      (bound != -1 && bound != LioNet::GetThreadId())) {
+    schedule(std::move(target));
+    Fiber::YieldToReady();
+    return;
+  }
+
+  if (t_handoff == target) {
+    target = std::move(t_handoff);
+  } else {
+    if (t_handoff) {
+      schedule(std::move(t_handoff));
+    }
+    // 目标可能还在某个队列里：认领之后队列中的那一项出队时被丢弃；
+    // 已经被其他线程取走时它很快会运行，只让出当前协程
+    int state = target->m_queueState.load(std::memory_order_acquire);
+    do {
+      if (state == Fiber::CLAIMED) {
+        Fiber::YieldToReady();
+        return;
+      }
+    } while (!target->m_queueState.compare_exchange_weak(
+        state, Fiber::CLAIMED, std::memory_order_acq_rel));
+  }
+  LIONET_ASSERT(target->getState() != Fiber::EXEC &&
+                target->getState() != Fiber::TERM &&
+                target->getState() != Fiber::EXCEPT);
+
+  cur->m_state = Fiber::READY;
+  t_handoff = std::move(t_running);
+  t_running = std::move(target);
+  Fiber* to = t_running.get();
+  to->m_state = Fiber::EXEC;
+  Fiber::SetThis(to);
+  Fiber::SwitchContext(cur, to);
+}
+
+void Scheduler::Park(void (*fn)(Fiber::ptr, void*), void* arg) {
+  Fiber* cur = Fiber::Current();
+  LIONET_ASSERT2(t_running.get() == cur,
+                 "Park must be called from a fiber run by the scheduler");
+  LIONET_ASSERT(cur->m_state == Fiber::EXEC);
+  t_park_fn = fn;
+  t_park_arg = arg;
+  cur->m_state = Fiber::HOLD;
+  cur->swapOut();
+}
+
+Fiber* Scheduler::GetRunningFiber() {
+  return t_running.get();
 }
 
 void Scheduler::tickle() {
-  LIONET_INFO(g_logger) << "tickle";
+  // 与 park 中先登记再检查队列配对：入队在前、检查休眠在后，不会漏掉唤醒
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (m_parkedCount.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  Worker* w = nullptr;
+  {
+    Spinlock::Lock lock(m_parkMutex);
+    if (!m_parked.empty()) {
+      // 尽量不唤醒等待定时器的线程，它醒来后还要有线程接替等待
+      auto it = m_parked.end() - 1;
+      if (*it == m_timerKeeper.load(std::memory_order_relaxed) &&
+          m_parked.size() > 1) {
+        --it;
+      }
+      w = *it;
+      m_parked.erase(it);
+      w->parked = false;
+      --m_parkedCount;
+    }
+  }
+  if (w) {
+    LIONET_DEBUG(g_logger) << "tickle";
+    w->unpark();
+  }
+}
+
+void Scheduler::wakeWorker(Worker* w) {
+  // 与 tickle() 相同，投递在前、检查休眠在后
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (w->retired.load(std::memory_order_relaxed)) {
+    if (w->retired.exchange(false)) {
+      w->unpark();
+    }
+    return;
+  }
+  if (m_parkedCount.load(std::memory_order_relaxed) == 0) {
+    return;
+  }
+  {
+    Spinlock::Lock lock(m_parkMutex);
+    if (!w->parked) {
+      return;
+    }
+    m_parked.erase(std::find(m_parked.begin(), m_parked.end(), w));
+    w->parked = false;
+    --m_parkedCount;
+  }
+  w->unpark();
+}
+
+bool Scheduler::hasWork(Worker* w) const {
+  if (m_globalSize.load(std::memory_order_relaxed) > 0) {
+    return true;
+  }
+  if (m_policy == POLICY_EDF) {
+    for (auto i : m_workers) {
+      if (i->deadlineSize.load(std::memory_order_relaxed) > 0) {
+        return true;
+      }
+    }
+  }
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    if (w->mailboxSize[level].load(std::memory_order_relaxed) > 0 ||
+        !m_inject[level]->empty()) {
+      return true;
+    }
+    for (auto i : m_workers) {
+      if (!i->queue[level].empty()) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+void Scheduler::park(Worker* w) {
+  uint32_t spin_us = s_idle_spin_us;
+  if (spin_us > 0) {
+    uint64_t deadline = LioNet::GetCurrentUS() + spin_us;
+    do {
+      for (int i = 0; i < 64; ++i) {
+        CpuRelax();
+      }
+      if (hasWork(w) || stopping()) {
+        return;
+      }
+    } while (LioNet::GetCurrentUS() < deadline);
+  }
+
+  w->wakeup.store(0, std::memory_order_relaxed);
+  {
+    Spinlock::Lock lock(m_parkMutex);
+    w->parked = true;
+    m_parked.push_back(w);
+    ++m_parkedCount;
+  }
+  // 登记之后再检查一次，期间入队的任务要么在这里看到，要么 tickle 看到登记
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if (hasWork(w) || stopping()) {
+    Spinlock::Lock lock(m_parkMutex);
+    if (w->parked) {
+      m_parked.erase(std::find(m_parked.begin(), m_parked.end(), w));
+      w->parked = false;
+      --m_parkedCount;
+    }
+    return;
+  }
+  // 有定时器时一个线程等到最早的到期时间；登记在前、读取到期时间在后，
+  // 与插入定时器后检查等待线程配对
+  Worker* expected = nullptr;
+  bool keeper =
+      hasTimer() && m_timerKeeper.compare_exchange_strong(expected, w);
+  uint64_t timeout_ms = keeper ? getNextTimer() : ~0ull;
+  // 停止中排空超时后要丢弃定时器，不等到它们到期
+  uint64_t deadline = m_drainDeadline.load(std::memory_order_relaxed);
+  if (keeper && deadline && !m_cancelling.load(std::memory_order_relaxed)) {
+    uint64_t now = LioNet::GetCurrentUS();
+    timeout_ms = std::min<uint64_t>(
+        timeout_ms, deadline > now ? (deadline - now + 999) / 1000 : 0);
+  }
+  // 自适应时 0 号线程定时醒来评估，所有线程都空闲时线程池也能逐步缩小
+  if (m_adaptive && w->index == 0 &&
+      m_activeWorkers.load(std::memory_order_relaxed) > m_minWorkers) {
+    timeout_ms = std::min<uint64_t>(
+        timeout_ms, std::max<uint32_t>(1, s_adaptive_interval_ms));
+  }
+  while (w->wakeup.load(std::memory_order_acquire) == 0) {
+    if (timeout_ms == ~0ull) {
+      FutexWait(&w->wakeup, 0);
+      continue;
+    }
+    if (timeout_ms > 0) {
+      struct timespec ts = {static_cast<time_t>(timeout_ms / 1000),
+                            static_cast<long>(timeout_ms % 1000) * 1000000};
+      FutexWait(&w->wakeup, 0, &ts);
+      if (w->wakeup.load(std::memory_order_acquire) != 0) {
+        continue;
+      }
+    }
+    Spinlock::Lock lock(m_parkMutex);
+    if (w->parked) {
+      m_parked.erase(std::find(m_parked.begin(), m_parked.end(), w));
+      w->parked = false;
+      --m_parkedCount;
+      break;
+    }
+    // 已经被 tickle() 取出，等待它的唤醒
+    timeout_ms = ~0ull;
+  }
+  if (keeper) {
+    m_timerKeeper.store(nullptr, std::memory_order_release);
+  }
+}
+
+void Scheduler::onTimerInsertedAtFront() {
+  // 插入在前、检查等待线程在后，与 park 中先登记再读取到期时间配对
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  Worker* keeper = m_timerKeeper.load(std::memory_order_relaxed);
+  if (keeper) {
+    wakeWorker(keeper);
+  } else {
+    tickle();
+  }
+}
+
+bool Scheduler::processTimers() {
+  std::vector<std::function<void()> > cbs;
+  listExpiredCbs(cbs);
+  for (auto& cb : cbs) {
+    schedule(std::move(cb));
+  }
+  return !cbs.empty();
+}
+
+bool Scheduler::takeRetired(Worker* w, FiberAndThread& ft) {
+  ++m_activeThreadCount;
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    if (takeMailbox(w, level, ft)) {
+      return true;
+    }
+  }
+  --m_activeThreadCount;
+  retire(w);
+  return false;
+}
+
+void Scheduler::retire(Worker* w) {
+  // 本地队列整体移入全局队列，保留协程的认领状态：过期项在全局队列出队时丢弃
+  bool moved = false;
+  {
+    MutexType::Lock lock(m_mutex);
+    for (int level = 0; level < kPriorityLevels; ++level) {
+      WorkStealingQueue<FiberAndThread>& queue = w->queue[level];
+      while (!queue.empty()) {
+        FiberAndThread* node = queue.steal();
+        if (!node) {
+          continue;
+        }
+        m_fibers.push_back(std::move(*node));
+        m_globalSize.fetch_add(1, std::memory_order_relaxed);
+        w->releaseNode(node);
+        moved = true;
+      }
+    }
+  }
+  // 休眠栈中停用的线程也可能被 tickle() 唤醒，把这次唤醒转交给启用的线程
+  if (moved || hasWork(w)) {
+    tickle();
+  }
+
+  w->wakeup.store(0, std::memory_order_relaxed);
+  w->retired.store(true, std::memory_order_relaxed);
+  // 先登记再检查，与 setActiveWorkers() 和 wakeWorker() 先修改再检查登记配对
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  bool mailbox = false;
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    mailbox |= w->mailboxSize[level].load(std::memory_order_relaxed) > 0;
+  }
+  if ((mailbox || m_stopping.load(std::memory_order_acquire) ||
+       w->index < m_activeWorkers.load(std::memory_order_relaxed)) &&
+      w->retired.exchange(false)) {
+    return;
+  }
+  while (w->wakeup.load(std::memory_order_acquire) == 0) {
+    FutexWait(&w->wakeup, 0);
+  }
+}
+
+void Scheduler::setAdaptive(size_t min_workers, size_t max_workers) {
+  max_workers = std::min(max_workers, m_threadCount);
+  min_workers = std::max<size_t>(1, std::min(min_workers, max_workers));
+  m_adaptive = m_threadCount > 0;
+  m_minWorkers = min_workers;
+  m_maxWorkers = max_workers;
+}
+
+void Scheduler::setActiveWorkers(size_t n) {
+  m_activeWorkers.store(n, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  for (size_t i = 0; i < n && i < m_workers.size(); ++i) {
+    Worker* w = m_workers[i];
+    if (w->retired.load(std::memory_order_relaxed) &&
+        w->retired.exchange(false)) {
+      w->unpark();
+    }
+  }
+}
+
+void Scheduler::adaptWorkers() {
+  if (m_stopping.load(std::memory_order_acquire)) {
+    return;
+  }
+  uint64_t now = LioNet::GetCurrentUS();
+  uint64_t last = m_adaptLast.load(std::memory_order_relaxed);
+  if (now < last + s_adaptive_interval_ms * 1000ull ||
+      !m_adaptLast.compare_exchange_strong(last, now,
+                                           std::memory_order_acq_rel)) {
+    return;
+  }
+
+  size_t active = m_activeWorkers.load(std::memory_order_relaxed);
+  // 空闲时间：已经结束的空闲，加上正在空闲的线程到现在为止还没有计入的部分
+  uint64_t idle = m_idleUs.exchange(0, std::memory_order_relaxed);
+  for (auto w : m_workers) {
+    uint64_t start = w->idleStart.load(std::memory_order_relaxed);
+    if (start && start < now && w->index < active &&
+        w->idleStart.compare_exchange_strong(start, now)) {
+      idle += now - start;
+    }
+  }
+  size_t depth = getQueueDepth();
+  uint64_t samples = m_waitCount.exchange(0, std::memory_order_relaxed);
+  uint64_t wait_sum = m_waitSum.exchange(0, std::memory_order_relaxed);
+  uint64_t wait = samples ? wait_sum / samples : 0;
+  uint64_t elapsed = std::max<uint64_t>(1, now - last);
+  uint64_t idle_percent =
+      std::min<uint64_t>(100, idle * 100 / (elapsed * active));
+
+  // 扩容一次增加一半，尽快消化积压；缩容一次减少一个，避免负载波动时来回调整
+  size_t target = active;
+  if (active < m_maxWorkers && idle_percent < s_adaptive_idle_percent &&
+      (depth > active * s_adaptive_queue_depth || wait > s_adaptive_wait_us)) {
+    target = std::min(m_maxWorkers, active + std::max<size_t>(1, active / 2));
+  } else if (active > m_minWorkers &&
+             idle_percent >= s_adaptive_idle_percent && depth <= active &&
+             wait <= s_adaptive_wait_us) {
+    target = active - 1;
+  }
+  if (target == active) {
+    return;
+  }
+  LIONET_INFO(g_logger) << "scheduler " << m_name << " "
+                        << (target > active ? "grow" : "shrink")
+                        << " workers " << active << " -> " << target
+                        << " queued=" << depth << " idle=" << idle_percent
+                        << "% wait=" << wait << "us";
+  ++(target > active ? m_grows : m_shrinks);
+  setActiveWorkers(target);
 }
 
 bool Scheduler::stopping() {
-  MutexType::Lock lock(m_mutex);
-  return m_autoStop && m_stopping && m_fibers.empty() &&
-         m_activeThreadCount == 0;
+  // 排队、运行中的任务都计在入队与结束计数的差中，不用加锁扫描各个队列；
+  // 循环定时器永远不会自己结束，只等待一次性定时器
+  return m_autoStop.load(std::memory_order_acquire) &&
+         m_stopping.load(std::memory_order_acquire) && inflight() == 0 &&
+         !hasOneShotTimer();
 }
 
 void Scheduler::idle() {
   LIONET_INFO(g_logger) << "run idle task";
+  Worker* w = getLocalWorker();
+  LIONET_ASSERT(w);
   while (!stopping()) {
+    // 放弃排空后丢弃剩下的定时器，唤醒其他线程检查是否已经排空
+    if (hasTimer() && cancelling()) {
+      size_t dropped = clearTimers();
+      if (dropped > 0) {
+        LIONET_INFO(g_logger) << "scheduler " << m_name << " stopping, drop "
+                              << dropped << " timers";
+      }
+      wakeAll();
+      continue;
+    }
+    // 到期的定时器回调入队后回到调度协程运行，不休眠
+    if (hasTimer() && processTimers()) {
+      Fiber::YieldToHold();
+      continue;
+    }
+    if (m_adaptive) {
+      adaptWorkers();
+      w->idleStart.store(LioNet::GetCurrentUS(), std::memory_order_relaxed);
+    }
+    park(w);
+    if (m_adaptive) {
+      uint64_t start = w->idleStart.exchange(0);
+      uint64_t now = LioNet::GetCurrentUS();
+      if (start && now > start) {
+        m_idleUs.fetch_add(now - start, std::memory_order_relaxed);
+      }
+    }
     Fiber::YieldToHold();
   }
 }
 
+namespace {
+
+/**
+ * @brief switchTo 的目标
+ */
+struct SwitchTarget {
+  Scheduler* scheduler;
+  int thread;
+};
+
+}  // namespace
+
+static void ParkSwitch(Fiber::ptr fiber, void* arg) {
+  SwitchTarget* target = static_cast<SwitchTarget*>(arg);
+  target->scheduler->schedule(std::move(fiber), target->thread);
+}
+
 void Scheduler::switchTo(int thread) {
   LIONET_ASSERT(Scheduler::GetThis() != nullptr);
   if (Scheduler::GetThis() == this) {
@@ -240,6 +1634,12 @@ void Scheduler::switchTo(int thread) {
       return;
     }
   }
+  if (GetRunningFiber() == Fiber::Current()) {
+    // 切出之后再调度到目标，避免在本线程切出前被目标线程运行
+    SwitchTarget target = {this, thread};
+    Park(&ParkSwitch, &target);
+    return;
+  }
   schedule(LioNet::Fiber::GetThis(), thread);
   LioNet::Fiber::YieldToHold();
 }
@@ -247,8 +1647,49 @@ void Scheduler::switchTo(int thread) {
 std::ostream& Scheduler::dump(std::ostream& os) {
   os << "[Scheduler name=" << m_name << " size=" << m_threadCount
      << " active_count=" << m_activeThreadCount
-     << " idle_count=" << m_idleThreadCount << " stopping=" << m_stopping
-     << " ]" << std::endl
+     << " idle_count=" << m_idleThreadCount << " stopping=" << m_stopping.load()
+     << " inflight=" << inflight() << " global=" << m_globalSize;
+  if (m_placement != PLACEMENT_NONE) {
+    os << " placement=" << m_placement << " l3=";
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+      os << (i ? "," : "") << m_workers[i]->l3;
+    }
+  }
+  // 各项按优先级从高到低以 / 分隔，多个工作线程以 , 分隔
+  Stats stats = getStats();
+  os << " queued=";
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    os << (level ? "/" : "") << stats.queued[level];
+  }
+  os << " inject=";
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    os << (level ? "/" : "") << m_inject[level]->size();
+  }
+  os << " local=";
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    for (int level = 0; level < kPriorityLevels; ++level) {
+      os << (level ? "/" : (i ? "," : "")) << m_workers[i]->queue[level].size();
+    }
+  }
+  os << " mailbox=";
+  for (size_t i = 0; i < m_workers.size(); ++i) {
+    for (int level = 0; level < kPriorityLevels; ++level) {
+      os << (level ? "/" : (i ? "," : "")) << m_workers[i]->mailboxSize[level];
+    }
+  }
+  if (m_policy == POLICY_EDF) {
+    os << " deadline=";
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+      os << (i ? "," : "") << m_workers[i]->deadlineSize;
+    }
+    os << " dropped=" << stats.dropped;
+  }
+  if (m_adaptive) {
+    os << " workers=" << stats.workers << "[" << m_minWorkers << "-"
+       << m_maxWorkers << "] grows=" << stats.grows
+       << " shrinks=" << stats.shrinks;
+  }
+  os << " ]" << std::endl
      << "    ";
   for (size_t i = 0; i < m_threadIds.size(); ++i) {
     if (i) {
@@ -259,6 +1700,45 @@ std::ostream& Scheduler::dump(std::ostream& os) {
   return os;
 }
 
+size_t Scheduler::getQueueDepth() const {
+  size_t depth = m_globalSize.load(std::memory_order_relaxed);
+  for (auto w : m_workers) {
+    depth += w->deadlineSize.load(std::memory_order_relaxed);
+    for (int level = 0; level < kPriorityLevels; ++level) {
+      depth += w->queue[level].size();
+    }
+  }
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    depth += m_inject[level]->size();
+  }
+  return depth;
+}
+
+Scheduler::Stats Scheduler::getStats() const {
+  Stats stats;
+  for (int level = 0; level < kPriorityLevels; ++level) {
+    stats.queued[level] = m_inject[level]->size();
+    for (auto w : m_workers) {
+      stats.queued[level] += w->queue[level].size() + w->mailboxSize[level];
+    }
+  }
+  stats.deadline = 0;
+  for (auto w : m_workers) {
+    stats.deadline += w->deadlineSize;
+  }
+  stats.dropped = m_deadlineDropped;
+  stats.global = m_globalSize;
+  stats.active = m_activeThreadCount;
+  stats.idle = m_idleThreadCount;
+  stats.parked = m_parkedCount;
+  stats.workers = m_activeWorkers;
+  stats.grows = m_grows;
+  stats.shrinks = m_shrinks;
+  stats.inflight = inflight();
+  stats.cancelled = m_cancelled;
+  return stats;
+}
+
 SchedulerSwitcher::SchedulerSwitcher(Scheduler* target) {
   m_caller = Scheduler::GetThis();
   if (target) {
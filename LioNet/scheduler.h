@@ -6,26 +6,118 @@
 #ifndef __LIONET_SCHEDULER_H__
 #define __LIONET_SCHEDULER_H__
 
+#include <stdint.h>
+#include <atomic>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <memory>
+#include <type_traits>
+#include <utility>
 #include <vector>
 
 #include "fiber.h"
+#include "future.h"
+#include "mpmc_queue.h"
 #include "thread.h"
+#include "timer.h"
 
 namespace LioNet {
 
+class SchedulerGroup;
+
 /**
  * @brief 协程调度器
  * @details 封装M: N的协程调度器
-            内部维护线程池，支持协程在其中切换
+            内部维护线程池，支持协程在其中切换。
+            每个工作线程有一个本地的 Chase-Lev 队列，工作线程上发起的调度直接
+            压入本地队列，不加锁；本地队列空时随机选择其他线程窃取任务。
+            外部线程的调度进入有界无锁的注入队列，满时阻塞等待工作线程消费，
+            工作线程定期从中批量取任务到本地。
+            指定了线程的任务投递到该线程的邮箱并只唤醒该线程。
+            任务分为几个固定的优先级，本地队列、邮箱和注入队列都按优先级分开，
+            工作线程按加权轮转在各级之间取任务，低优先级不会饿死。
+            EDF 策略下带截止时间的任务放入每个工作线程的最小堆，
+            工作线程优先取所有堆中截止时间最早的任务。
+            可以按放置策略把工作线程绑定到 CPU，绑定后线程的协程栈从所在 NUMA 节点分配，
+            窃取时先尝试同一个 L3 缓存域的线程。
+            开启自适应后按负载在上下限之间调整启用的工作线程数，多余的线程休眠。
+            定时器到期后回调作为任务调度；空闲时由一个休眠的工作线程等到最早的到期时间，
+            stop() 等到所有定时器触发或取消。
+            调度器记录已接受、还没有结束的任务数，stop() 时最后一个任务结束的线程
+            一次唤醒所有休眠的线程退出；可以限定排空的时间，超时后或者指定取消时
+            丢弃还没有开始运行的任务
  */
-class Scheduler {
+class Scheduler : public TimerManager {
  public:
   typedef Mutex MutexType;
   typedef std::shared_ptr<Scheduler> ptr;
 
+  /**
+   * @brief 任务优先级，数值越小越优先
+   */
+  enum Priority {
+    PRIORITY_HIGH = 0,    // 延迟敏感的任务，如请求处理
+    PRIORITY_NORMAL = 1,  // 默认
+    PRIORITY_LOW = 2      // 后台任务，如压缩、刷盘
+  };
+
+  static const int kPriorityLevels = 3;  // 优先级个数
+
+  /**
+   * @brief 队列策略
+   */
+  enum QueuePolicy {
+    POLICY_FIFO = 0,  // 默认，忽略截止时间
+    POLICY_EDF = 1    // 带截止时间的任务按截止时间最早优先运行
+  };
+
+  /**
+   * @brief 停止时对还没有开始运行的任务的处理
+   */
+  enum DrainMode {
+    DRAIN_ALL = 0,    // 默认，运行完所有排队的任务（受排空超时限制）
+    DRAIN_CANCEL = 1  // 丢弃还没有开始运行的任务，只等待已经开始的协程
+  };
+
+  /**
+   * @brief 工作线程的 CPU 放置策略，只作用于 start() 创建的线程
+   */
+  enum Placement {
+    PLACEMENT_NONE = 0,     // 默认，不绑定
+    PLACEMENT_COMPACT = 1,  // 依次占满一个 L3 域再到下一个，同一个核的超线程相邻
+    PLACEMENT_SCATTER = 2,  // 轮流分散到各个 L3 域，域内先占不同的物理核
+    PLACEMENT_LIST = 3,     // 依次绑定到给定列表中的 CPU
+    PLACEMENT_L3 = 4        // 轮流绑定到各个 L3 域，可以在域内的所有 CPU 上运行
+  };
+
+  /**
+   * @brief 丢弃过期任务时的回调
+   * @details 参数为任务的协程（函数任务为 nullptr）、函数（协程任务为空）和截止时间。
+   *          丢弃的协程处于 HOLD/READY 状态，回调可以重新调度它
+   */
+  typedef std::function<void(Fiber::ptr fiber, Task& func, uint64_t deadline)>
+      DeadlineMissCallback;
+
+  /**
+   * @brief 统计信息
+   */
+  struct Stats {
+    // 各优先级排队的任务数（本地队列、邮箱、注入队列）
+    size_t queued[kPriorityLevels];
+    size_t global;                   // 全局队列中的任务数
+    size_t active;                   // 正在运行任务的线程数
+    size_t idle;                     // 空闲线程数
+    size_t parked;                   // 休眠的线程数
+    size_t deadline;                 // EDF 堆中排队的任务数
+    uint64_t dropped;                // 过期丢弃的任务数
+    size_t workers;                  // 启用的工作线程数
+    uint64_t grows;                  // 自适应扩容的次数
+    uint64_t shrinks;                // 自适应缩容的次数
+    size_t inflight;                 // 已接受、还没有结束的任务数
+    uint64_t cancelled;              // 停止时丢弃的任务数
+  };
+
   /**
    * @brief 构造函数
    * @param[in] threads 线程数量
@@ -45,6 +137,11 @@ class Scheduler {
    */
   const std::string& getName() const { return m_name; }
 
+  /**
+   * @brief 返回工作线程数，包括 use_caller 的调用线程
+   */
+  size_t getWorkerCount() const { return m_workers.size(); }
+
   /**
    * @brief 返回当前协程调度器
    */
@@ -55,31 +152,112 @@ class Scheduler {
    */
   static Fiber* GetMainFiber();
 
+  /**
+   * @brief 返回当前线程上由调度器切入、正在运行的协程，没有返回 nullptr
+   */
+  static Fiber* GetRunningFiber();
+
+  /**
+   * @brief 挂起当前协程，切回调度协程后调用 fn(当前协程, arg)
+   * @details fn 在协程上下文保存之后执行，负责把协程登记到等待者中，
+   *          之后唤醒方可以在任意线程 schedule 它而不会与切出过程竞争。
+   *          挂起的协程为 HOLD 状态，调度器不会自动把它重新入队
+   * @pre 当前协程由调度器运行
+   */
+  static void Park(void (*fn)(Fiber::ptr, void*), void* arg);
+
   /**
    * @brief 启动协程调度器
    */
   void start();
 
   /**
-   * @brief 停止协程调度器
+   * @brief 停止协程调度器，等待任务排空后返回
+   * @param[in] mode 对还没有开始运行的任务的处理
+   * @details 排空指排队和正在运行的任务都已结束、没有一次性定时器；挂起中的协程
+   *          不计在内。循环定时器不等待，停止后留在时间轮上，再次 start() 后继续触发。
+   *          DRAIN_CANCEL 或超过排空超时（见 setDrainTimeout）后丢弃：
+   *          函数任务和还没有运行过的协程，出队时丢弃，不运行，async() 的任务
+   *          以 broken_promise 异常结束；时间轮上所有的定时器，不执行回调，
+   *          等待定时器恢复的协程保持挂起。已经开始的协程照常运行到结束或挂起，
+   *          stop() 等待的只剩正在运行的任务
    */
-  void stop();
+  void stop(DrainMode mode = DRAIN_ALL);
+
+  /**
+   * @brief 设置 stop() 排空的超时时间（毫秒），0 不超时
+   * @details 默认为 scheduler.drain_timeout_ms。超时后不再等待排队的任务和
+   *          定时器，正在运行的任务不会被打断
+   */
+  void setDrainTimeout(uint64_t ms) { m_drainTimeoutMs = ms; }
+
+  /**
+   * @brief 返回 stop() 排空的超时时间（毫秒）
+   */
+  uint64_t getDrainTimeout() const { return m_drainTimeoutMs; }
 
   /**
    * @brief 调度协程
    * @param[in] func 协程或者函数
    * @param[in] thread 协程执行的线程id， -1标识任意线程
+   * @param[in] priority 优先级，见 Priority；-1 表示协程沿用自己的优先级，
+   *            函数为 PRIORITY_NORMAL。指定给协程的优先级在它让出后重新入队时保留
+   */
+  template <class FiberOrFunc>
+  void schedule(FiberOrFunc&& func, int thread = -1, int priority = -1) {
+    FiberAndThread ft(std::forward<FiberOrFunc>(func), thread);
+    if (!ft.fiber && !ft.func) {
+      return;
+    }
+    if (priority != -1) {
+      ft.priority = priority;
+      if (ft.fiber) {
+        ft.fiber->m_priority = priority;
+      }
+    }
+    enqueue(std::move(ft));
+  }
+
+  /**
+   * @brief 调度函数并返回它的结果
+   * @param[in] fn 函数，以 fn() 方式调用
+   * @param[in] priority 优先级，见 Priority；-1 为 PRIORITY_NORMAL
+   * @return fn 的返回值或抛出的异常。在协程中 get() 挂起协程，在其他线程中阻塞线程；
+   *         调度器停止时还没有运行的任务以 broken_promise 异常结束
+   */
+  template <class F>
+  Future<typename std::result_of<F()>::type> async(F&& fn,
+                                                   int priority = -1) {
+    typedef typename std::result_of<F()>::type R;
+    Promise<R> promise;
+    Future<R> future = promise.getFuture();
+    schedule(FutureTask<R, typename std::decay<F>::type>(
+                 std::move(promise), std::forward<F>(fn)),
+             -1, priority);
+    return future;
+  }
+
+  /**
+   * @brief 调度带截止时间的协程
+   * @param[in] func 协程或者函数
+   * @param[in] deadline 截止时间，GetCurrentUS() 的微秒时间
+   * @param[in] thread 协程执行的线程id， -1标识任意线程
+   * @details 只在 POLICY_EDF 下按截止时间排序；FIFO 策略或指定了线程时按 schedule 处理。
+   *          截止时间记录在协程上，让出后重新入队或被唤醒时沿用，
+   *          设置了 DeadlineMissCallback 时过期的协程出队时被丢弃
    */
   template <class FiberOrFunc>
-  void schedule(FiberOrFunc func, int thread = -1) {
-    bool need_tickle = false;
-    {
-      MutexType::Lock lock(m_mutex);
-      need_tickle = scheduleNonLock(func, thread);
+  void scheduleDeadline(FiberOrFunc&& func, uint64_t deadline,
+                        int thread = -1) {
+    FiberAndThread ft(std::forward<FiberOrFunc>(func), thread);
+    if (!ft.fiber && !ft.func) {
+      return;
     }
-    if (need_tickle) {
-      tickle();
+    ft.deadline = deadline;
+    if (ft.fiber) {
+      ft.fiber->m_deadline = deadline;
     }
+    enqueue(std::move(ft));
   }
 
   /**
@@ -89,26 +267,117 @@ class Scheduler {
    */
   template <class InputIterater>
   void schedule(InputIterater begin, InputIterater end) {
-    bool need_tickle = false;
-    {
-      MutexType::Lock lock(m_mutex);
-      while (begin != end) {
-        need_tickle = scheduleNonLock(*begin, -1) || need_tickle;
-        ++begin;
-      }
-    }
-
-    if (need_tickle) {
-      tickle();
+    while (begin != end) {
+      schedule(*begin);
+      ++begin;
     }
   }
 
   void switchTo(int thread = -1);
+
+  /**
+   * @brief 当前协程让出（READY）并直接切换到 target，不经过调度协程
+   * @param[in] target 目标协程
+   * @pre 当前协程由本调度器运行；target 处于 INIT/READY/HOLD，
+   *      且没有被其他线程运行或同时调度
+   * @details 让出的协程放在线程的交接位上，回到调度协程时入队；
+   *          如果随后的 yieldTo 目标正是它，则直接切换，ping-pong 每条消息只切换一次且不加锁。
+   *          target 在调度队列中时由当前线程认领，队列中的那一项出队时被丢弃；
+   *          已经被其他线程取走时只让出当前协程。共享栈协程之间、或目标绑定在其他线程时
+   *          退化为 schedule(target) + YieldToReady。
+   */
+  void yieldTo(Fiber::ptr target);
   std::ostream& dump(std::ostream& os);
 
+  /**
+   * @brief 返回统计信息（并发修改时为近似值）
+   */
+  Stats getStats() const;
+
+  /**
+   * @brief 返回可以由任意工作线程运行的排队任务数（近似值，不含邮箱），不加锁
+   */
+  size_t getQueueDepth() const;
+
+  /**
+   * @brief 设置调度函数任务时创建的协程是否使用共享栈
+   * @details 共享栈协程第一次运行后固定在该线程上调度
+   */
+  void setSharedStack(bool v) { m_sharedStack = v; }
+
+  /**
+   * @brief 函数任务是否运行在共享栈协程上
+   */
+  bool isSharedStack() const { return m_sharedStack; }
+
+  /**
+   * @brief 设置队列策略，需在 start() 之前调用
+   */
+  void setQueuePolicy(QueuePolicy v) { m_policy = v; }
+
+  /**
+   * @brief 返回队列策略
+   */
+  QueuePolicy getQueuePolicy() const { return m_policy; }
+
+  /**
+   * @brief 设置过期任务的回调，需在 start() 之前调用
+   * @details 设置后 EDF 堆中已经过期的任务出队时不再运行，交给回调处理；
+   *          不设置时过期任务截止时间最早，最先运行
+   */
+  void setDeadlineMissCallback(DeadlineMissCallback cb) {
+    m_deadlineMiss = std::move(cb);
+  }
+
+  /**
+   * @brief 设置工作线程的放置策略，需在 start() 之前调用
+   * @param[in] placement 放置策略
+   * @param[in] cpus PLACEMENT_LIST 使用的 CPU 列表，线程多于 CPU 时循环使用
+   */
+  void setPlacement(Placement placement,
+                    const std::vector<int>& cpus = std::vector<int>()) {
+    m_placement = placement;
+    m_placementCpus = cpus;
+  }
+
+  /**
+   * @brief 返回放置策略
+   */
+  Placement getPlacement() const { return m_placement; }
+
+  /**
+   * @brief 开启工作线程数自适应，需在 start() 之前调用
+   * @param[in] min_workers 启用的工作线程数下限，至少为 1
+   * @param[in] max_workers 启用的工作线程数上限，不超过构造时的线程数
+   * @details 按构造时的线程数创建线程，启动时只启用 min_workers 个。
+   *          运行中每隔 scheduler.adaptive.interval_ms 按排队任务数、空闲时间和
+   *          采样的排队延迟评估一次：积压或延迟超过阈值时扩容，空闲超过阈值时缩容。
+   *          停用的线程休眠而不退出，本地队列交给其他线程，只运行指定到本线程的任务。
+   *          每次调整记录日志并计入 Stats。use_caller 的调用线程不参与调整
+   */
+  void setAdaptive(size_t min_workers, size_t max_workers);
+
+  /**
+   * @brief 是否开启了工作线程数自适应
+   */
+  bool isAdaptive() const { return m_adaptive; }
+
  protected:
+  /**
+   * @brief 有更早到期的定时器：唤醒等待定时器的线程按新的时间重新休眠，
+   *        没有这样的线程时唤醒一个休眠的线程
+   */
+  void onTimerInsertedAtFront() override;
+
+  /**
+   * @brief 取出到期的定时器，回调作为任务调度
+   * @return 是否有到期的定时器
+   */
+  bool processTimers();
+
   /**
    * @brief 通知协程调度器有任务了
+   * @details 唤醒一个休眠的工作线程，没有休眠的线程时什么也不做
    */
   virtual void tickle();
 
@@ -124,6 +393,8 @@ class Scheduler {
 
   /**
    * @brief 协程无任务时可调度执行idle协程
+   * @details 先自旋 scheduler.idle_spin_us 微秒等待新任务，之后在 futex 上休眠，
+   *          由 tickle() 唤醒
    */
   virtual void idle();
 
@@ -132,24 +403,195 @@ class Scheduler {
    */
   void setThis();
 
+  /**
+   * @brief 切入协程并处理返回调度协程时的协程
+   * @details 期间可能发生 yieldTo，返回的协程不一定是 fiber。
+   *          READY/HOLD 的协程重新入队，交接位上的协程也一并入队
+   * @return 执行结束（TERM/EXCEPT）的协程，其他情况返回 nullptr
+   */
+  Fiber::ptr resume(Fiber::ptr fiber);
+
   /**
    * @brief 是否有空闲线程
    */
   bool hasIdleThreads() { return m_idleThreadCount > 0; }
 
  private:
+  struct FiberAndThread;
+  struct Worker;
+
   /**
-   * @brief 协程调度启动（无锁）
+   * @brief 入队之后唤醒一个休眠的工作线程（有空闲线程时）
    */
-  template <class FiberOrFunc>
-  bool scheduleNonLock(FiberOrFunc func, int thread) {
-    bool need_tickle = m_fibers.empty();
-    FiberAndThread ft(func, thread);
-    if (ft.fiber || ft.func) {
-      m_fibers.push_back(ft);
-    }
-    return need_tickle;
-  }
+  void notifyIdle();
+
+  /**
+   * @brief 唤醒所有休眠的工作线程
+   */
+  void wakeAll();
+
+  /**
+   * @brief n 个任务结束（运行后切出或出队时丢弃），停止中排空时唤醒所有线程退出
+   */
+  void finishTasks(size_t n = 1);
+
+  /**
+   * @brief 已接受、还没有结束的任务数
+   */
+  uint64_t inflight() const;
+
+  /**
+   * @brief 停止中是否放弃排空（DRAIN_CANCEL 或超过排空的截止时间）
+   */
+  bool cancelling();
+
+  /**
+   * @brief 停止中需要取消时丢弃还没有开始运行的任务
+   * @return 任务已丢弃
+   */
+  bool cancelTask(FiberAndThread& ft);
+
+  /**
+   * @brief 工作线程 w 是否有可以运行或窃取的任务（近似值）
+   */
+  bool hasWork(Worker* w) const;
+
+  /**
+   * @brief 唤醒休眠中的指定工作线程
+   */
+  void wakeWorker(Worker* w);
+
+  /**
+   * @brief 返回运行在 thread 上的工作线程，还没有开始运行返回 nullptr
+   * @details 查线程id表，不扫描所有工作线程
+   */
+  Worker* findWorker(int thread) const;
+
+  /**
+   * @brief 把开始运行的工作线程登记到线程id表
+   */
+  void registerWorker(Worker* w, int thread);
+
+  /**
+   * @brief 把指定线程的任务投递到该工作线程的邮箱并唤醒它
+   */
+  void postMailbox(Worker* w, FiberAndThread&& ft);
+
+  /**
+   * @brief 从本线程的邮箱取一个 level 优先级的任务
+   */
+  bool takeMailbox(Worker* w, int level, FiberAndThread& ft);
+
+  /**
+   * @brief 认领出队的协程，不是协程时直接返回 true
+   * @return 已被其他线程或 yieldTo 认领返回 false
+   */
+  static bool ClaimFiber(Fiber* fiber);
+
+  /**
+   * @brief 当前工作线程自旋等待任务，超时后休眠直到 tickle() 唤醒
+   * @details 先登记到休眠栈再检查队列，与入队后检查休眠栈的 tickle() 配对，不会漏掉唤醒
+   */
+  void park(Worker* w);
+
+  /**
+   * @brief 放入全局队列（需持有 m_mutex）
+   * @return 放入前全局队列是否为空
+   */
+  bool scheduleNonLock(FiberAndThread&& ft);
+
+  /**
+   * @brief 入队：不指定线程的任务在本调度器的工作线程上放入本地队列，
+   *        在其他线程上放入注入队列；指定线程的任务投递到邮箱
+   */
+  void enqueue(FiberAndThread&& ft);
+
+  /**
+   * @brief 注入队列已满时等待工作线程消费后再入队
+   * @details 还没有启动或正在停止、或者没有其他工作线程时不能等待，放入全局队列
+   */
+  void injectSlow(FiberAndThread&& ft);
+
+  /**
+   * @brief 从 level 优先级的注入队列批量取任务，第一个返回，其余放入本地队列
+   */
+  bool takeInjected(Worker* w, int level, FiberAndThread& ft);
+
+  /**
+   * @brief 返回当前线程在本调度器中的工作线程，不是工作线程返回 nullptr
+   */
+  Worker* getLocalWorker() const;
+
+  /**
+   * @brief 为工作线程取一个任务，按加权轮转选择优先级，再尝试全局队列
+   * @details 取到任务时活跃线程数已经加一
+   * @param[out] tickle_me 全局队列中有其他线程的任务
+   */
+  bool takeTask(Worker* w, FiberAndThread& ft, bool& tickle_me);
+
+  /**
+   * @brief 从本线程取一个 level 优先级的任务，依次尝试邮箱与本地队列、注入队列
+   */
+  bool takeLevel(Worker* w, int level, FiberAndThread& ft);
+
+  /**
+   * @brief 从全局队列取一个任务，并顺带把一批不指定线程的任务搬到本地队列
+   */
+  bool takeGlobal(Worker* w, FiberAndThread& ft, bool& tickle_me);
+
+  /**
+   * @brief 从随机选择的其他工作线程窃取一个 level 优先级的任务
+   */
+  bool stealTask(Worker* w, int level, FiberAndThread& ft);
+
+  /**
+   * @brief 按放置策略返回第 index 个创建的线程绑定的 CPU，不绑定返回空
+   */
+  std::vector<int> placeCpus(size_t index) const;
+
+  /**
+   * @brief 放入工作线程 w 的 EDF 堆
+   */
+  void pushDeadline(Worker* w, FiberAndThread&& ft);
+
+  /**
+   * @brief 从所有工作线程的 EDF 堆中取截止时间最早的任务
+   */
+  bool takeDeadline(FiberAndThread& ft);
+
+  /**
+   * @brief 从工作线程 w 的 EDF 堆取一个任务，过期任务交给回调
+   * @return 堆为空返回 false
+   */
+  bool popDeadline(Worker* w, FiberAndThread& ft);
+
+  /**
+   * @brief 认领从本地队列取出的任务并回收节点
+   * @return 过期的协程项（已被 yieldTo 认领）返回 false
+   */
+  bool claimNode(Worker* w, FiberAndThread* node, FiberAndThread& ft);
+
+  /**
+   * @brief 停用的工作线程取任务：只取本线程的邮箱，没有任务时休眠到被重新启用
+   * @details 取到任务时活跃线程数已经加一
+   */
+  bool takeRetired(Worker* w, FiberAndThread& ft);
+
+  /**
+   * @brief 停用工作线程 w：本地队列移入全局队列，休眠到被重新启用、
+   *        邮箱有任务或调度器停止
+   */
+  void retire(Worker* w);
+
+  /**
+   * @brief 到了评估间隔时按负载调整启用的工作线程数，同一时刻只有一个线程评估
+   */
+  void adaptWorkers();
+
+  /**
+   * @brief 设置启用的工作线程数，唤醒重新启用的线程
+   */
+  void setActiveWorkers(size_t n);
 
  private:
   /**
@@ -157,22 +599,37 @@ class Scheduler {
    */
   struct FiberAndThread {
     Fiber::ptr fiber;            // 协程
-    std::function<void()> func;  // 协程执行函数
+    Task func;                   // 协程执行函数
     int thread;                  // 线程id
+    int priority = PRIORITY_NORMAL;  // 优先级
+    uint64_t deadline = 0;           // 截止时间（微秒），0 没有
+    uint64_t enqueued = 0;  // 采样的入队时间（微秒），0 没有采样
 
     /**
      * @brief 构造函数
      * @param[in] f 协程指针
      * @param[in] thr 线程id
      */
-    FiberAndThread(Fiber::ptr f, int thr) : fiber(f), thread(thr) {}
+    FiberAndThread(Fiber::ptr f, int thr) : fiber(std::move(f)), thread(thr) {
+      if (fiber) {
+        if (thread == -1) {
+          thread = fiber->getBoundThread();
+        }
+        if (fiber->m_priority != -1) {
+          priority = fiber->m_priority;
+        }
+        deadline = fiber->m_deadline;
+      }
+    }
 
     /**
      * @brief 构造函数
      * @param[in] f 协程执行函数
      * @param[in] thr 线程id
      */
-    FiberAndThread(std::function<void()> f, int thr) : func(f), thread(thr) {}
+    template <class F, class = typename std::enable_if<
+                           std::is_constructible<Task, F&&>::value>::type>
+    FiberAndThread(F&& f, int thr) : func(std::forward<F>(f)), thread(thr) {}
 
     /**
      * @brief 构造函数
@@ -180,8 +637,17 @@ class Scheduler {
      * @param[in] thr 线程id
      * @post *f = nullptr
      */
-    FiberAndThread(std::function<void()>* f, int thr) : thread(thr) {
-      func.swap(*f);
+    FiberAndThread(Task* f, int thr) : thread(thr) { func.swap(*f); }
+
+    /**
+     * @brief 构造函数
+     * @param[in] f 协程执行函数指针
+     * @param[in] thr 线程id
+     * @post *f = nullptr
+     */
+    FiberAndThread(std::function<void()>* f, int thr)
+        : func(std::move(*f)), thread(thr) {
+      *f = nullptr;
     }
 
     /**
@@ -189,6 +655,9 @@ class Scheduler {
      */
     FiberAndThread() : thread(-1) {}
 
+    FiberAndThread(FiberAndThread&&) = default;
+    FiberAndThread& operator=(FiberAndThread&&) = default;
+
     /**
      * @brief 重置数据
      */
@@ -196,13 +665,57 @@ class Scheduler {
       fiber = nullptr;
       func = nullptr;
       thread = -1;
+      priority = PRIORITY_NORMAL;
+      deadline = 0;
+      enqueued = 0;
     }
   };
 
  private:
   MutexType m_mutex;
   std::vector<Thread::ptr> m_threads;  // 线程池
-  std::list<FiberAndThread> m_fibers;  // 待执行的协程队列
+  std::list<FiberAndThread> m_fibers;     // 全局队列（目标线程未启动、注入溢出）
+  std::list<FiberAndThread> m_freeNodes;  // 出队后缓存的空链表节点
+  std::atomic<size_t> m_globalSize{0};    // 全局队列长度，无锁预判是否为空
+  // 外部线程提交任务的注入队列，每个优先级一个
+  MPMCQueue<FiberAndThread>* m_inject[kPriorityLevels];
+  std::atomic<size_t> m_injectWaiters{0};  // 等待注入队列空位的生产者数量
+  Semaphore m_injectNotFull;               // 注入队列有空位时通知生产者
+  Spinlock m_parkMutex;                    // 保护 m_parked
+  std::vector<Worker*> m_parked;           // 休眠的工作线程，后进先唤醒
+  std::atomic<size_t> m_parkedCount{0};    // 休眠的工作线程数量
+  std::vector<Worker*> m_workers;         // 每个工作线程的本地队列
+  std::atomic<size_t> m_nextWorker{0};    // 下一个启动的工作线程编号
+  // 线程id到工作线程的开放寻址表，槽数不少于工作线程数的两倍；
+  // 高 32 位为线程id，低 32 位为编号加一，0 为空槽。run() 开始时插入，start() 时清空
+  std::unique_ptr<std::atomic<uint64_t>[]> m_workerSlots;
+  size_t m_workerMask = 0;
+  QueuePolicy m_policy = POLICY_FIFO;     // 队列策略
+  DeadlineMissCallback m_deadlineMiss;    // 过期任务回调
+  std::atomic<size_t> m_nextDeadline{0};  // 外部线程轮流放入的 EDF 堆
+  std::atomic<uint64_t> m_deadlineDropped{0};  // 过期丢弃的任务数
+  Placement m_placement = PLACEMENT_NONE;      // 工作线程放置策略
+  std::vector<int> m_placementCpus;            // PLACEMENT_LIST 的 CPU 列表
+  bool m_adaptive = false;                     // 是否自适应调整工作线程数
+  size_t m_minWorkers = 0;                     // 启用的工作线程数下限
+  size_t m_maxWorkers = 0;                     // 启用的工作线程数上限
+  // 启用的工作线程数，编号不小于它的工作线程停用
+  std::atomic<size_t> m_activeWorkers{0};
+  std::atomic<uint64_t> m_adaptLast{0};  // 上次评估的时间（微秒）
+  std::atomic<uint64_t> m_idleUs{0};     // 上次评估以来结束的空闲时间之和
+  std::atomic<uint64_t> m_waitSum{0};    // 上次评估以来采样的排队时间之和
+  std::atomic<uint64_t> m_waitCount{0};  // 上次评估以来的采样数
+  std::atomic<uint64_t> m_grows{0};      // 扩容的次数
+  std::atomic<uint64_t> m_shrinks{0};    // 缩容的次数
+  // 休眠时等待最早的定时器到期的工作线程，同一时刻最多一个
+  std::atomic<Worker*> m_timerKeeper{nullptr};
+  // 非工作线程入队、结束的任务数；工作线程计在各自的 Worker 中
+  std::atomic<uint64_t> m_added{0};
+  std::atomic<uint64_t> m_finished{0};
+  std::atomic<bool> m_cancelling{false};       // 停止中丢弃还没有开始的任务
+  std::atomic<uint64_t> m_drainDeadline{0};    // 排空的截止时间（微秒），0 没有
+  std::atomic<uint64_t> m_cancelled{0};        // 停止时丢弃的任务数
+  uint64_t m_drainTimeoutMs = 0;               // 排空超时（毫秒），0 不超时
   Fiber::ptr m_rootFiber;  // use_caller为true时有效，调度协程
   std::string m_name;      // 协程调度器名称
 
@@ -211,14 +724,22 @@ class Scheduler {
   size_t m_threadCount = 0;                    // 线程数量
   std::atomic<size_t> m_activeThreadCount{0};  // 工作线程数量
   std::atomic<size_t> m_idleThreadCount{0};    // 空闲线程数量
-  bool m_stopping;                             // 是否正在停止
-  bool m_autoStop;                             // 是否主动停止
+  // 由 stop()/start() 写入，工作线程不加锁读取
+  std::atomic<bool> m_stopping{true};          // 是否正在停止
+  std::atomic<bool> m_autoStop{false};         // 是否主动停止
+  bool m_sharedStack = false;                  // 函数任务是否使用共享栈
   int m_rootThread = 0;                        // 主线程id（use_caller）
 };
 
 class SchedulerSwitcher : public Noncopyable {
  public:
   SchedulerSwitcher(Scheduler* target = nullptr);
+
+  /**
+   * @brief 切换到 key 所在的分片，析构时切换回来
+   * @details 已经在该分片上时不切换
+   */
+  SchedulerSwitcher(SchedulerGroup& group, uint64_t key);
   ~SchedulerSwitcher();
 
  private:
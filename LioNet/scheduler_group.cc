@@ -0,0 +1,135 @@
+#include "scheduler_group.h"
+#include "config.h"
+#include "cpu_topology.h"
+#include "log.h"
+#include "macro.h"
+
+namespace LioNet {
+
+static LioNet::Logger::ptr g_logger = LIONET_LOG_NAME("system");
+
+static ConfigVar<uint32_t>::ptr g_scheduler_group_overflow_depth =
+    Config::Lookup<uint32_t>(
+        "scheduler.group.overflow_depth", 256,
+        "queued tasks on a shard above which new tasks go to another shard");
+
+/**
+ * @brief 打散路由键，连续的 id 也均匀分布到各个分片
+ */
+static uint64_t MixKey(uint64_t key) {
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+  return key;
+}
+
+SchedulerGroup::SchedulerGroup(size_t shards, size_t threads,
+                               const std::string& name)
+    : m_name(name),
+      m_overflowDepth(g_scheduler_group_overflow_depth->getValue()) {
+  LIONET_ASSERT(shards > 0);
+  for (size_t i = 0; i < shards; ++i) {
+    m_shards.push_back(std::make_shared<Scheduler>(
+        threads, false, m_name + "_" + std::to_string(i)));
+  }
+}
+
+SchedulerGroup::~SchedulerGroup() {
+  stop();
+}
+
+size_t SchedulerGroup::getHome(uint64_t key) const {
+  return MixKey(key) % m_shards.size();
+}
+
+int SchedulerGroup::indexOf(const Scheduler* scheduler) const {
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    if (m_shards[i].get() == scheduler) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+Scheduler* SchedulerGroup::route(uint64_t key) {
+  Scheduler* home = m_shards[getHome(key)].get();
+  if (m_overflowDepth == 0 || m_shards.size() == 1) {
+    return home;
+  }
+  size_t depth = home->getQueueDepth();
+  if (depth <= m_overflowDepth) {
+    return home;
+  }
+  // 只在积压时扫描其他分片，分片数不多，逐个读取排队数
+  Scheduler* best = home;
+  size_t best_depth = depth;
+  for (auto& shard : m_shards) {
+    size_t d = shard->getQueueDepth();
+    if (d < best_depth) {
+      best = shard.get();
+      best_depth = d;
+    }
+  }
+  // 差距不大时留在本分片，避免为了少量排队失去亲和性
+  if (best_depth * 2 >= depth) {
+    return home;
+  }
+  m_overflows.fetch_add(1, std::memory_order_relaxed);
+  return best;
+}
+
+void SchedulerGroup::placeShardsByL3() {
+  const CpuTopology* topo = CpuTopology::GetInstance();
+  int l3_count = topo->getL3Count();
+  if (l3_count <= 0) {
+    return;
+  }
+  for (size_t i = 0; i < m_shards.size(); ++i) {
+    m_shards[i]->setPlacement(Scheduler::PLACEMENT_LIST,
+                              topo->getL3Cpus(i % l3_count));
+  }
+}
+
+void SchedulerGroup::start() {
+  if (m_started) {
+    return;
+  }
+  m_started = true;
+  for (auto& shard : m_shards) {
+    shard->start();
+  }
+  LIONET_INFO(g_logger) << "scheduler group " << m_name << " started with "
+                        << m_shards.size() << " shards";
+}
+
+void SchedulerGroup::stop() {
+  if (m_stopped) {
+    return;
+  }
+  m_stopped = true;
+  for (auto& shard : m_shards) {
+    shard->stop();
+  }
+}
+
+std::ostream& SchedulerGroup::dump(std::ostream& os) {
+  os << "[SchedulerGroup name=" << m_name << " shards=" << m_shards.size()
+     << " overflow_depth=" << m_overflowDepth
+     << " overflows=" << m_overflows << "]" << std::endl;
+  for (auto& shard : m_shards) {
+    shard->dump(os);
+  }
+  return os;
+}
+
+SchedulerSwitcher::SchedulerSwitcher(SchedulerGroup& group, uint64_t key) {
+  m_caller = Scheduler::GetThis();
+  Scheduler* target = group.getShard(group.getHome(key));
+  if (target != m_caller) {
+    target->switchTo();
+  }
+}
+
+}  // namespace LioNet
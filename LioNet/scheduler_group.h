@@ -0,0 +1,138 @@
+/**
+ * @file scheduler_group.h
+ * @brief 分片调度器组
+ */
+
+#ifndef __LIONET_SCHEDULER_GROUP_H__
+#define __LIONET_SCHEDULER_GROUP_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace LioNet {
+
+/**
+ * @brief 分片调度器组
+ * @details 持有 N 个相互独立的 Scheduler 分片，每个分片有自己的队列和工作线程，
+ *          分片之间没有共享的队列和锁。任务按键（连接 id、租户、哈希值）路由到固定的
+ *          分片，相关的任务留在同一个分片上，缓存保持热度。
+ *          键所在分片可被任意线程运行的排队任务超过溢出阈值时，新任务改投排队最少的分片，
+ *          已经在运行的协程不迁移。协程让出后回到当前所在的分片，
+ *          用 SchedulerSwitcher 在分片之间切换
+ */
+class SchedulerGroup : Noncopyable {
+ public:
+  typedef std::shared_ptr<SchedulerGroup> ptr;
+
+  /**
+   * @brief 构造函数
+   * @param[in] shards 分片数
+   * @param[in] threads 每个分片的线程数
+   * @param[in] name 名称，分片名为 name_序号
+   */
+  SchedulerGroup(size_t shards, size_t threads, const std::string& name = "");
+
+  /**
+   * @brief 析构函数，停止所有分片
+   */
+  ~SchedulerGroup();
+
+  /**
+   * @brief 返回名称
+   */
+  const std::string& getName() const { return m_name; }
+
+  /**
+   * @brief 返回分片数
+   */
+  size_t size() const { return m_shards.size(); }
+
+  /**
+   * @brief 返回第 i 个分片，start() 之前可以单独配置
+   */
+  Scheduler* getShard(size_t i) const { return m_shards[i].get(); }
+
+  /**
+   * @brief 返回 key 所在分片的序号，不考虑溢出
+   */
+  size_t getHome(uint64_t key) const;
+
+  /**
+   * @brief 返回调度器在组内的序号，不属于本组返回 -1
+   */
+  int indexOf(const Scheduler* scheduler) const;
+
+  /**
+   * @brief 返回 key 的任务应该投递的分片
+   * @details 通常是 key 所在的分片；该分片排队超过溢出阈值、
+   *          且排队最少的分片不到它的一半时返回后者
+   */
+  Scheduler* route(uint64_t key);
+
+  /**
+   * @brief 按 key 调度协程或函数
+   * @param[in] key 路由键
+   * @param[in] func 协程或者函数
+   * @param[in] priority 优先级，见 Scheduler::Priority
+   */
+  template <class FiberOrFunc>
+  void schedule(uint64_t key, FiberOrFunc&& func, int priority = -1) {
+    route(key)->schedule(std::forward<FiberOrFunc>(func), -1, priority);
+  }
+
+  /**
+   * @brief 设置溢出阈值（排队任务数），0 关闭溢出，需在 start() 之前调用
+   * @details 默认取配置 scheduler.group.overflow_depth
+   */
+  void setOverflowDepth(size_t depth) { m_overflowDepth = depth; }
+
+  /**
+   * @brief 返回溢出阈值
+   */
+  size_t getOverflowDepth() const { return m_overflowDepth; }
+
+  /**
+   * @brief 返回因溢出改投其他分片的任务数
+   */
+  uint64_t getOverflowCount() const { return m_overflows; }
+
+  /**
+   * @brief 每个分片的线程绑定到一个 L3 缓存域，需在 start() 之前调用
+   * @details 分片按序号轮流对应各个 L3 域，分片内的线程依次绑定到域内的 CPU，
+   *          分片的任务和数据留在同一个 L3 缓存里，协程栈从域所在的 NUMA 节点分配
+   */
+  void placeShardsByL3();
+
+  /**
+   * @brief 启动所有分片
+   */
+  void start();
+
+  /**
+   * @brief 依次停止所有分片
+   * @details 分片之间互相投递的任务要在 stop() 之前结束，已经停止的分片不再运行任务
+   */
+  void stop();
+
+  std::ostream& dump(std::ostream& os);
+
+ private:
+  std::string m_name;
+  std::vector<Scheduler::ptr> m_shards;
+  size_t m_overflowDepth;
+  std::atomic<uint64_t> m_overflows{0};
+  bool m_started = false;
+  bool m_stopped = false;
+};
+
+}  // namespace LioNet
+
+#endif
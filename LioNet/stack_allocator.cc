@@ -0,0 +1,272 @@
+#include "stack_allocator.h"
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "config.h"
+#include "log.h"
+#include "macro.h"
+
+namespace LioNet {
+
+static Logger::ptr g_logger = LIONET_LOG_NAME("system");
+
+static ConfigVar<bool>::ptr g_stack_pool_enable = Config::Lookup<bool>(
+    "fiber.stack_pool.enable", true, "use pooled mmap fiber stacks");
+
+static ConfigVar<uint32_t>::ptr g_stack_pool_max_cached =
+    Config::Lookup<uint32_t>("fiber.stack_pool.max_cached", 1024,
+                             "max cached fiber stacks per thread per class");
+
+// 配置读取需要加读写锁，分配路径上使用缓存值
+static std::atomic<bool> s_stack_pool_enable{true};
+static std::atomic<uint32_t> s_stack_pool_max_cached{1024};
+
+struct StackPoolIniter {
+  StackPoolIniter() {
+    s_stack_pool_enable = g_stack_pool_enable->getValue();
+    s_stack_pool_max_cached = g_stack_pool_max_cached->getValue();
+    g_stack_pool_enable->addListener(
+        [](const bool&, const bool& new_value) {
+          s_stack_pool_enable = new_value;
+        });
+    g_stack_pool_max_cached->addListener(
+        [](const uint32_t&, const uint32_t& new_value) {
+          s_stack_pool_max_cached = new_value;
+        });
+  }
+};
+
+static StackPoolIniter __stack_pool_init;
+
+static std::atomic<StackAllocator*> s_default_allocator{nullptr};
+
+StackAllocator* StackAllocator::GetDefault() {
+  StackAllocator* a = s_default_allocator.load(std::memory_order_acquire);
+  if (a) {
+    return a;
+  }
+  if (s_stack_pool_enable.load(std::memory_order_relaxed)) {
+    return PooledStackAllocator::GetInstance();
+  }
+  return MallocStackAllocator::GetInstance();
+}
+
+void StackAllocator::SetDefault(StackAllocator* allocator) {
+  s_default_allocator.store(allocator, std::memory_order_release);
+}
+
+void* MallocStackAllocator::alloc(size_t size) {
+  return malloc(size);
+}
+
+void MallocStackAllocator::dealloc(void* vp, size_t size) {
+  free(vp);
+}
+
+MallocStackAllocator* MallocStackAllocator::GetInstance() {
+  static MallocStackAllocator s_instance;
+  return &s_instance;
+}
+
+// 大小等级 i 对应 2^i 个页，超过最大等级的栈不缓存
+static const size_t kStackClasses = 16;
+
+static size_t PageSize() {
+  static const size_t s_page_size = sysconf(_SC_PAGESIZE);
+  return s_page_size;
+}
+
+static std::atomic<uint64_t> s_hits{0};
+static std::atomic<uint64_t> s_misses{0};
+static std::atomic<uint64_t> s_cached{0};
+static std::atomic<uint64_t> s_mapped{0};
+static std::atomic<uint64_t> s_bound{0};
+
+// 新映射的栈优先分配物理页的 NUMA 节点，-1 不指定
+static thread_local int t_stack_node = -1;
+// 内核或容器不支持 mbind 时只报告一次，之后不再尝试
+static std::atomic<bool> s_mbind_enable{true};
+// mbind 节点掩码支持的最大节点数
+static const int kMaxNumaNodes = 1024;
+
+/**
+ * @brief 让 [vp, vp + bytes) 优先从 node 分配物理页，映射后还没有访问过时调用
+ */
+static void BindStack(void* vp, size_t bytes, int node) {
+  if (node < 0 || node >= kMaxNumaNodes ||
+      !s_mbind_enable.load(std::memory_order_relaxed)) {
+    return;
+  }
+  const size_t bits = sizeof(unsigned long) * 8;
+  unsigned long mask[kMaxNumaNodes / (sizeof(unsigned long) * 8)] = {};
+  mask[node / bits] |= 1ul << (node % bits);
+  // maxnode 比掩码位数多一，与 numa_* 库的用法一致
+  if (syscall(SYS_mbind, vp, bytes, MPOL_PREFERRED, mask, kMaxNumaNodes + 1,
+              0)) {
+    if (s_mbind_enable.exchange(false)) {
+      LIONET_WARN(g_logger) << "mbind fiber stack fail, node=" << node
+                            << " errno=" << errno << " " << strerror(errno);
+    }
+    return;
+  }
+  ++s_bound;
+}
+
+static size_t StackClass(size_t size) {
+  size_t pages = (size + PageSize() - 1) / PageSize();
+  size_t cls = 0;
+  while (((size_t)1 << cls) < pages) {
+    ++cls;
+  }
+  return cls;
+}
+
+static size_t ClassBytes(size_t cls) {
+  return PageSize() << cls;
+}
+
+static void* MapStack(size_t bytes) {
+  void* base = mmap(nullptr, bytes + PageSize(), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_STACK,
+                    -1, 0);
+  if (base == MAP_FAILED) {
+    LIONET_ERROR(g_logger) << "mmap fiber stack fail, size=" << bytes
+                           << " errno=" << errno << " " << strerror(errno);
+    throw std::bad_alloc();
+  }
+  if (mprotect(base, PageSize(), PROT_NONE)) {
+    LIONET_ERROR(g_logger) << "mprotect fiber stack guard fail, errno="
+                           << errno << " " << strerror(errno);
+  }
+  ++s_mapped;
+  void* vp = (char*)base + PageSize();
+  BindStack(vp, bytes, t_stack_node);
+  return vp;
+}
+
+static void UnmapStack(void* vp, size_t bytes) {
+  if (munmap((char*)vp - PageSize(), bytes + PageSize())) {
+    LIONET_ERROR(g_logger) << "munmap fiber stack fail, errno=" << errno
+                           << " " << strerror(errno);
+  }
+  --s_mapped;
+}
+
+namespace {
+/**
+ * @brief 线程私有的空闲栈缓存
+ */
+struct StackCache {
+  std::vector<void*> free[kStackClasses];
+
+  void clear() {
+    for (size_t i = 0; i < kStackClasses; ++i) {
+      s_cached -= free[i].size();
+      for (auto vp : free[i]) {
+        UnmapStack(vp, ClassBytes(i));
+      }
+      free[i].clear();
+    }
+  }
+
+  ~StackCache() { clear(); }
+};
+
+struct StackCacheHolder {
+  StackCache* cache = nullptr;
+  ~StackCacheHolder();
+};
+}  // namespace
+
+static thread_local StackCache* t_stack_cache = nullptr;
+static thread_local bool t_stack_cache_destroyed = false;
+static thread_local StackCacheHolder t_stack_cache_holder;
+
+StackCacheHolder::~StackCacheHolder() {
+  t_stack_cache = nullptr;
+  t_stack_cache_destroyed = true;
+  delete cache;
+}
+
+// 线程退出析构缓存之后返回 nullptr，此时直接 munmap
+static StackCache* GetStackCache() {
+  if (LIONET_LIKELY(t_stack_cache != nullptr)) {
+    return t_stack_cache;
+  }
+  if (t_stack_cache_destroyed) {
+    return nullptr;
+  }
+  t_stack_cache = new StackCache;
+  t_stack_cache_holder.cache = t_stack_cache;
+  return t_stack_cache;
+}
+
+void* PooledStackAllocator::alloc(size_t size) {
+  size_t cls = StackClass(size);
+  if (cls < kStackClasses) {
+    StackCache* cache = GetStackCache();
+    if (cache && !cache->free[cls].empty()) {
+      void* vp = cache->free[cls].back();
+      cache->free[cls].pop_back();
+      s_cached.fetch_sub(1, std::memory_order_relaxed);
+      s_hits.fetch_add(1, std::memory_order_relaxed);
+      return vp;
+    }
+  }
+  s_misses.fetch_add(1, std::memory_order_relaxed);
+  return MapStack(ClassBytes(cls));
+}
+
+void PooledStackAllocator::dealloc(void* vp, size_t size) {
+  size_t cls = StackClass(size);
+  if (cls < kStackClasses) {
+    StackCache* cache = GetStackCache();
+    if (cache && cache->free[cls].size() <
+                     s_stack_pool_max_cached.load(std::memory_order_relaxed)) {
+      cache->free[cls].push_back(vp);
+      s_cached.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+  }
+  UnmapStack(vp, ClassBytes(cls));
+}
+
+size_t PooledStackAllocator::guardSize() const {
+  return PageSize();
+}
+
+PooledStackAllocator::Stats PooledStackAllocator::getStats() const {
+  Stats stats;
+  stats.hits = s_hits;
+  stats.misses = s_misses;
+  stats.cached = s_cached;
+  stats.mapped = s_mapped;
+  stats.bound = s_bound;
+  return stats;
+}
+
+void PooledStackAllocator::trimThreadCache() {
+  if (t_stack_cache) {
+    t_stack_cache->clear();
+  }
+}
+
+void PooledStackAllocator::SetThreadNode(int node) {
+  t_stack_node = node;
+}
+
+int PooledStackAllocator::GetThreadNode() {
+  return t_stack_node;
+}
+
+PooledStackAllocator* PooledStackAllocator::GetInstance() {
+  static PooledStackAllocator s_instance;
+  return &s_instance;
+}
+
+}  // namespace LioNet
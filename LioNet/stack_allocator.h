@@ -0,0 +1,125 @@
+/**
+ * @file stack_allocator.h
+ * @brief 协程栈分配器
+ */
+
+#ifndef __LIONET_STACK_ALLOCATOR_H__
+#define __LIONET_STACK_ALLOCATOR_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "noncopyable.h"
+
+namespace LioNet {
+
+/**
+ * @brief 协程栈分配器接口
+ * @details 分配器需要在使用它的所有协程销毁之前保持有效，一般为进程生命周期的单例
+ */
+class StackAllocator : Noncopyable {
+ public:
+  virtual ~StackAllocator() {}
+
+  /**
+   * @brief 分配协程栈
+   * @param[in] size 栈大小
+   * @return 栈的低地址
+   */
+  virtual void* alloc(size_t size) = 0;
+
+  /**
+   * @brief 释放协程栈
+   * @param[in] vp alloc 返回的地址
+   * @param[in] size 分配时的栈大小
+   */
+  virtual void dealloc(void* vp, size_t size) = 0;
+
+  /**
+   * @brief 栈低地址之下保护页的大小，0 表示没有保护页
+   */
+  virtual size_t guardSize() const { return 0; }
+
+  /**
+   * @brief 返回新建协程使用的分配器
+   * @details 未调用 SetDefault 时由配置 fiber.stack_pool.enable 决定
+   *          使用 PooledStackAllocator 还是 MallocStackAllocator
+   */
+  static StackAllocator* GetDefault();
+
+  /**
+   * @brief 设置新建协程使用的分配器，nullptr 恢复为按配置选择
+   * @pre allocator 生命周期长于所有使用它的协程
+   */
+  static void SetDefault(StackAllocator* allocator);
+};
+
+/**
+ * @brief malloc/free 实现的协程栈分配器
+ */
+class MallocStackAllocator : public StackAllocator {
+ public:
+  void* alloc(size_t size) override;
+  void dealloc(void* vp, size_t size) override;
+
+  /**
+   * @brief 返回单例
+   */
+  static MallocStackAllocator* GetInstance();
+};
+
+/**
+ * @brief mmap 实现的池化协程栈分配器
+ * @details 栈按页数的 2 的幂划分大小等级，每个线程每个等级维护一个空闲链表，
+ *          缓存个数上限由配置 fiber.stack_pool.max_cached 决定，线程退出时释放。
+ *          线程缓存与统计信息为所有实例共享。
+ *          每个栈的低地址下方有一个 PROT_NONE 保护页，栈溢出会触发 SIGSEGV 而不是破坏堆。
+ *          线程设置了 NUMA 节点时新映射的栈用 mbind 优先从该节点分配物理页；
+ *          缓存的栈在释放它的线程上复用，不再迁移。
+ */
+class PooledStackAllocator : public StackAllocator {
+ public:
+  /**
+   * @brief 统计信息
+   */
+  struct Stats {
+    uint64_t hits;    // 命中线程缓存的次数
+    uint64_t misses;  // 需要 mmap 的次数
+    uint64_t cached;  // 当前缓存的栈个数
+    uint64_t mapped;  // 当前 mmap 的栈个数（含缓存）
+    uint64_t bound;   // 绑定到 NUMA 节点的 mmap 次数
+  };
+
+  void* alloc(size_t size) override;
+  void dealloc(void* vp, size_t size) override;
+  size_t guardSize() const override;
+
+  /**
+   * @brief 返回统计信息
+   */
+  Stats getStats() const;
+
+  /**
+   * @brief 释放当前线程缓存的所有栈
+   */
+  void trimThreadCache();
+
+  /**
+   * @brief 设置当前线程新映射的栈所在的 NUMA 节点，-1 表示不指定（首次访问时分配）
+   */
+  static void SetThreadNode(int node);
+
+  /**
+   * @brief 返回当前线程新映射的栈所在的 NUMA 节点
+   */
+  static int GetThreadNode();
+
+  /**
+   * @brief 返回单例
+   */
+  static PooledStackAllocator* GetInstance();
+};
+
+}  // namespace LioNet
+
+#endif
@@ -0,0 +1,190 @@
+/**
+ * @file task.h
+ * @brief 只可移动的任务函数封装
+ */
+
+#ifndef __LIONET_TASK_H__
+#define __LIONET_TASK_H__
+
+#include <stddef.h>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace LioNet {
+
+/**
+ * @brief 无参无返回值的可调用对象，替代 std::function<void()>
+ * @details 只可移动，不可拷贝。不超过 kInlineSize 字节且移动构造不抛异常的
+ *          可调用对象直接存放在内部缓冲区中，构造和移动都不分配内存；
+ *          更大的对象分配在堆上，移动时只转移指针。
+ *          空的函数指针和空的 std::function 构造出空 Task。
+ */
+class Task {
+ public:
+  static const size_t kInlineSize = 48;
+
+  Task() noexcept {}
+
+  Task(std::nullptr_t) noexcept {}
+
+  /**
+   * @brief 从可调用对象构造
+   * @param[in] f 可调用对象，以 f() 方式调用
+   */
+  template <class F, class D = typename std::decay<F>::type,
+            class = typename std::enable_if<
+                !std::is_same<D, Task>::value &&
+                !std::is_same<D, std::nullptr_t>::value>::type,
+            class = decltype(std::declval<D&>()())>
+  Task(F&& f) {
+    if (IsNull(f)) {
+      return;
+    }
+    init<D>(std::forward<F>(f), std::integral_constant<bool, IsInline<D>()>());
+  }
+
+  Task(Task&& rhs) noexcept { moveFrom(rhs); }
+
+  Task& operator=(Task&& rhs) noexcept {
+    if (this != &rhs) {
+      clear();
+      moveFrom(rhs);
+    }
+    return *this;
+  }
+
+  Task& operator=(std::nullptr_t) noexcept {
+    clear();
+    return *this;
+  }
+
+  Task(const Task&) = delete;
+  Task& operator=(const Task&) = delete;
+
+  ~Task() { clear(); }
+
+  /**
+   * @brief 调用任务
+   * @pre 非空
+   */
+  void operator()() { m_ops->invoke(&m_storage); }
+
+  /**
+   * @brief 是否为空
+   */
+  explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+  void swap(Task& rhs) noexcept {
+    Task tmp(std::move(rhs));
+    rhs = std::move(*this);
+    *this = std::move(tmp);
+  }
+
+ private:
+  typedef typename std::aligned_storage<kInlineSize,
+                                        alignof(std::max_align_t)>::type
+      Storage;
+
+  /**
+   * @brief 类型擦除后的操作表，每种可调用对象类型一个静态实例
+   */
+  struct Ops {
+    void (*invoke)(Storage* s);
+    void (*move)(Storage* dst, Storage* src);  // 移动到 dst 并析构 src
+    void (*destroy)(Storage* s);
+  };
+
+  template <class D>
+  static constexpr bool IsInline() {
+    return sizeof(D) <= kInlineSize &&
+           alignof(std::max_align_t) % alignof(D) == 0 &&
+           std::is_nothrow_move_constructible<D>::value;
+  }
+
+  template <class D>
+  static bool IsNull(const D&) {
+    return false;
+  }
+
+  template <class R>
+  static bool IsNull(R (*const& f)()) {
+    return f == nullptr;
+  }
+
+  template <class R>
+  static bool IsNull(const std::function<R()>& f) {
+    return !f;
+  }
+
+  template <class D>
+  struct InlineOps {
+    static D* get(Storage* s) { return reinterpret_cast<D*>(s); }
+    static void invoke(Storage* s) { (*get(s))(); }
+    static void move(Storage* dst, Storage* src) {
+      ::new (dst) D(std::move(*get(src)));
+      get(src)->~D();
+    }
+    static void destroy(Storage* s) { get(s)->~D(); }
+    static const Ops ops;
+  };
+
+  template <class D>
+  struct HeapOps {
+    static D*& get(Storage* s) { return *reinterpret_cast<D**>(s); }
+    static void invoke(Storage* s) { (*get(s))(); }
+    static void move(Storage* dst, Storage* src) {
+      ::new (dst) D*(get(src));
+    }
+    static void destroy(Storage* s) { delete get(s); }
+    static const Ops ops;
+  };
+
+  template <class D, class F>
+  void init(F&& f, std::true_type) {
+    ::new (&m_storage) D(std::forward<F>(f));
+    m_ops = &InlineOps<D>::ops;
+  }
+
+  template <class D, class F>
+  void init(F&& f, std::false_type) {
+    ::new (&m_storage) D*(new D(std::forward<F>(f)));
+    m_ops = &HeapOps<D>::ops;
+  }
+
+  void moveFrom(Task& rhs) noexcept {
+    if (rhs.m_ops) {
+      rhs.m_ops->move(&m_storage, &rhs.m_storage);
+      m_ops = rhs.m_ops;
+      rhs.m_ops = nullptr;
+    }
+  }
+
+  void clear() noexcept {
+    if (m_ops) {
+      const Ops* ops = m_ops;
+      m_ops = nullptr;
+      ops->destroy(&m_storage);
+    }
+  }
+
+ private:
+  Storage m_storage;            // 内联存储或指向堆对象的指针
+  const Ops* m_ops = nullptr;   // 为空表示没有任务
+};
+
+template <class D>
+const Task::Ops Task::InlineOps<D>::ops = {&InlineOps<D>::invoke,
+                                           &InlineOps<D>::move,
+                                           &InlineOps<D>::destroy};
+
+template <class D>
+const Task::Ops Task::HeapOps<D>::ops = {&HeapOps<D>::invoke,
+                                         &HeapOps<D>::move,
+                                         &HeapOps<D>::destroy};
+
+}  // namespace LioNet
+
+#endif
@@ -0,0 +1,202 @@
+#include "task_graph.h"
+#include <algorithm>
+#include <exception>
+#include "macro.h"
+#include "parallel.h"
+#include "util.h"
+
+namespace LioNet {
+
+static const TaskGraph::NodeId kNoNode = (TaskGraph::NodeId)-1;
+
+TaskGraph::NodeId TaskGraph::addNode(std::function<void()> fn,
+                                     const std::string& name) {
+  LIONET_ASSERT2(!m_running, "cannot modify a running task graph");
+  m_nodes.emplace_back();
+  Node& node = m_nodes.back();
+  node.fn = std::move(fn);
+  node.name = name.empty() ? "node_" + std::to_string(m_nodes.size() - 1)
+                           : name;
+  m_dirty = true;
+  return m_nodes.size() - 1;
+}
+
+void TaskGraph::precede(NodeId before, NodeId after) {
+  LIONET_ASSERT2(!m_running, "cannot modify a running task graph");
+  LIONET_ASSERT(before < m_nodes.size() && after < m_nodes.size());
+  m_nodes[before].successors.push_back(after);
+  ++m_nodes[after].predecessors;
+  m_dirty = true;
+}
+
+void TaskGraph::prepare() {
+  std::vector<size_t> indegree(m_nodes.size());
+  m_order.clear();
+  m_roots.clear();
+  for (NodeId i = 0; i < m_nodes.size(); ++i) {
+    indegree[i] = m_nodes[i].predecessors;
+    if (indegree[i] == 0) {
+      m_roots.push_back(i);
+      m_order.push_back(i);
+    }
+  }
+  for (size_t k = 0; k < m_order.size(); ++k) {
+    for (NodeId succ : m_nodes[m_order[k]].successors) {
+      if (--indegree[succ] == 0) {
+        m_order.push_back(succ);
+      }
+    }
+  }
+  LIONET_ASSERT2(m_order.size() == m_nodes.size(), "task graph has a cycle");
+  m_dirty = false;
+}
+
+void TaskGraph::run(Scheduler* scheduler) {
+  bool running = false;
+  bool started = m_running.compare_exchange_strong(running, true);
+  LIONET_ASSERT2(started, "task graph is already running");
+  if (m_dirty) {
+    prepare();
+  }
+  if (!scheduler) {
+    scheduler = Scheduler::GetThis();
+  }
+  ParallelContext ctx(scheduler, 0);
+  m_ctx = &ctx;
+  m_scheduler = scheduler;
+  m_runStart = GetCurrentUS();
+  if (!scheduler || m_nodes.empty()) {
+    for (NodeId id : m_order) {
+      invoke(m_nodes[id]);
+    }
+  } else {
+    for (auto& node : m_nodes) {
+      node.pending.store(node.predecessors, std::memory_order_relaxed);
+    }
+    m_remaining.store(m_nodes.size(), std::memory_order_relaxed);
+    // 全部节点完成时由最后一个节点通知一次
+    ctx.add();
+    // 调用方执行第一个根节点，其余的交给调度器
+    for (size_t i = 1; i < m_roots.size(); ++i) {
+      submit(m_roots[i]);
+    }
+    execute(m_roots[0]);
+  }
+
+  std::exception_ptr error;
+  try {
+    ctx.wait();
+  } catch (...) {
+    error = std::current_exception();
+  }
+  m_elapsedUs = GetCurrentUS() - m_runStart;
+  m_ctx = nullptr;
+  m_scheduler = nullptr;
+  m_running = false;
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void TaskGraph::invoke(Node& node) {
+  node.start = GetCurrentUS();
+  if (!m_ctx->failed()) {
+    try {
+      node.fn();
+    } catch (...) {
+      m_ctx->fail(std::current_exception());
+    }
+  }
+  node.end = GetCurrentUS();
+}
+
+void TaskGraph::submit(NodeId id) {
+  m_scheduler->schedule([this, id] { execute(id); });
+}
+
+void TaskGraph::execute(NodeId id) {
+  while (id != kNoNode) {
+    Node& node = m_nodes[id];
+    invoke(node);
+    // 第一个就绪的后继接着在当前协程上执行，数据还在缓存里
+    NodeId next = kNoNode;
+    for (NodeId succ : node.successors) {
+      if (m_nodes[succ].pending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (next == kNoNode) {
+          next = succ;
+        } else {
+          submit(succ);
+        }
+      }
+    }
+    if (m_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      // 最后一个节点，通知之后图可能已经被重新执行或析构
+      m_ctx->done();
+      return;
+    }
+    id = next;
+  }
+}
+
+uint64_t TaskGraph::getStartUs(NodeId id) const {
+  const Node& node = m_nodes[id];
+  return node.start > m_runStart ? node.start - m_runStart : 0;
+}
+
+uint64_t TaskGraph::getDurationUs(NodeId id) const {
+  const Node& node = m_nodes[id];
+  return node.end - node.start;
+}
+
+std::vector<TaskGraph::NodeId> TaskGraph::getCriticalPath(
+    uint64_t* length_us) const {
+  std::vector<NodeId> path;
+  if (m_nodes.empty() || m_dirty) {
+    if (length_us) {
+      *length_us = 0;
+    }
+    return path;
+  }
+  // 按拓扑序求以每个节点结尾的最长路径，from 为前驱中的最大值
+  std::vector<uint64_t> dist(m_nodes.size());
+  std::vector<uint64_t> from(m_nodes.size(), 0);
+  std::vector<NodeId> prev(m_nodes.size(), kNoNode);
+  NodeId last = m_order[0];
+  for (NodeId id : m_order) {
+    dist[id] = from[id] + getDurationUs(id);
+    for (NodeId succ : m_nodes[id].successors) {
+      if (prev[succ] == kNoNode || dist[id] > from[succ]) {
+        from[succ] = dist[id];
+        prev[succ] = id;
+      }
+    }
+    // 相等时取拓扑序靠后的，耗时为 0 的后继也算在路径上
+    if (dist[id] >= dist[last]) {
+      last = id;
+    }
+  }
+  if (length_us) {
+    *length_us = dist[last];
+  }
+  for (NodeId id = last; id != kNoNode; id = prev[id]) {
+    path.push_back(id);
+  }
+  std::reverse(path.begin(), path.end());
+  return path;
+}
+
+std::ostream& TaskGraph::dump(std::ostream& os) const {
+  uint64_t critical = 0;
+  std::vector<NodeId> path = getCriticalPath(&critical);
+  os << "[TaskGraph nodes=" << m_nodes.size() << " elapsed=" << m_elapsedUs
+     << "us critical=" << critical << "us]" << std::endl;
+  for (NodeId id = 0; id < m_nodes.size(); ++id) {
+    bool on_path = std::find(path.begin(), path.end(), id) != path.end();
+    os << "    " << (on_path ? "* " : "  ") << m_nodes[id].name
+       << " start=" << getStartUs(id) << "us duration=" << getDurationUs(id)
+       << "us" << std::endl;
+  }
+  return os;
+}
+
+}  // namespace LioNet
@@ -0,0 +1,148 @@
+/**
+ * @file task_graph.h
+ * @brief 任务图（DAG）执行器
+ */
+
+#ifndef __LIONET_TASK_GRAPH_H__
+#define __LIONET_TASK_GRAPH_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "noncopyable.h"
+#include "scheduler.h"
+
+namespace LioNet {
+
+class ParallelContext;
+
+/**
+ * @brief 任务图
+ * @details 节点是可调用对象，边是依赖关系。执行时每个节点的未完成前驱数是一个原子计数，
+ *          前驱全部完成的节点立即交给调度器；一个节点完成后第一个就绪的后继在同一个协程上
+ *          接着执行，其余的调度出去。建好的图可以反复执行，执行过程不分配内存。
+ *          每次执行记录各节点的开始时间和耗时，用于分析关键路径
+ */
+class TaskGraph : Noncopyable {
+ public:
+  typedef std::shared_ptr<TaskGraph> ptr;
+  typedef size_t NodeId;
+
+  /**
+   * @brief 添加节点
+   * @param[in] fn 节点执行的函数，每次执行图时调用一次
+   * @param[in] name 节点名称，用于输出
+   * @return 节点编号，按添加顺序从 0 开始
+   */
+  NodeId addNode(std::function<void()> fn, const std::string& name = "");
+
+  /**
+   * @brief 添加依赖：after 在 before 完成后才执行
+   */
+  void precede(NodeId before, NodeId after);
+
+  /**
+   * @brief 返回节点数
+   */
+  size_t size() const { return m_nodes.size(); }
+
+  /**
+   * @brief 执行一次任务图，所有节点完成后返回
+   * @param[in] scheduler 调度器，nullptr 使用当前调度器；都没有时在当前线程按拓扑序执行
+   * @details 等待期间调用协程挂起而不阻塞工作线程（不在调度器协程中时阻塞调用线程）。
+   *          节点抛出的第一个异常在执行结束后重新抛出，之后开始的节点不再调用函数，
+   *          但依赖关系照常推进。同一个图不能同时执行多次
+   * @pre 图中没有环
+   */
+  void run(Scheduler* scheduler = nullptr);
+
+  /**
+   * @brief 返回上一次执行中节点的开始时间，相对于执行开始（微秒）
+   */
+  uint64_t getStartUs(NodeId id) const;
+
+  /**
+   * @brief 返回上一次执行中节点的耗时（微秒）
+   */
+  uint64_t getDurationUs(NodeId id) const;
+
+  /**
+   * @brief 返回上一次执行的总耗时（微秒）
+   */
+  uint64_t getElapsedUs() const { return m_elapsedUs; }
+
+  /**
+   * @brief 按上一次执行的耗时计算关键路径（耗时之和最大的依赖链）
+   * @param[out] length_us 关键路径的长度（微秒），可以为 nullptr
+   * @return 关键路径上的节点，从起点到终点
+   */
+  std::vector<NodeId> getCriticalPath(uint64_t* length_us = nullptr) const;
+
+  /**
+   * @brief 输出上一次执行的各节点耗时和关键路径
+   */
+  std::ostream& dump(std::ostream& os) const;
+
+ private:
+  /**
+   * @brief 节点
+   */
+  struct Node {
+    std::function<void()> fn;
+    std::string name;
+    std::vector<NodeId> successors;
+    size_t predecessors = 0;          // 前驱数
+    std::atomic<size_t> pending{0};   // 本次执行中未完成的前驱数
+    uint64_t start = 0;               // 本次执行的开始、结束时间（微秒）
+    uint64_t end = 0;
+
+    Node() {}
+    Node(Node&& other)
+        : fn(std::move(other.fn)),
+          name(std::move(other.name)),
+          successors(std::move(other.successors)),
+          predecessors(other.predecessors) {}
+  };
+
+  /**
+   * @brief 计算拓扑序，检查没有环
+   */
+  void prepare();
+
+  /**
+   * @brief 执行节点及其就绪的后继
+   */
+  void execute(NodeId id);
+
+  /**
+   * @brief 把节点交给调度器
+   */
+  void submit(NodeId id);
+
+  /**
+   * @brief 调用节点的函数并记录时间
+   */
+  void invoke(Node& node);
+
+ private:
+  std::vector<Node> m_nodes;
+  std::vector<NodeId> m_order;   // 拓扑序
+  std::vector<NodeId> m_roots;   // 没有前驱的节点
+  bool m_dirty = true;           // 添加节点或边之后需要重新计算拓扑序
+  std::atomic<bool> m_running{false};
+  std::atomic<size_t> m_remaining{0};  // 本次执行中未完成的节点数
+  Scheduler* m_scheduler = nullptr;
+  ParallelContext* m_ctx = nullptr;
+  uint64_t m_runStart = 0;
+  uint64_t m_elapsedUs = 0;
+};
+
+}  // namespace LioNet
+
+#endif
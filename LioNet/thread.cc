@@ -1,4 +1,6 @@
 #include "thread.h"
+#include <sched.h>
+#include <unistd.h>
 #include "log.h"
 #include "util.h"
 
@@ -28,8 +30,46 @@ void Thread::SetName(const std::string& name) {
   t_thread_name = name;
 }
 
-Thread::Thread(std::function<void()> func, const std::string& name)
-    : m_func(func), m_name(name) {
+bool Thread::SetAffinity(const std::vector<int>& cpus) {
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (cpus.empty()) {
+    // 恢复为进程主线程启动时可用的全部 CPU
+    if (sched_getaffinity(getpid(), sizeof(set), &set)) {
+      return false;
+    }
+  }
+  for (int cpu : cpus) {
+    if (cpu >= 0 && cpu < CPU_SETSIZE) {
+      CPU_SET(cpu, &set);
+    }
+  }
+  int rt = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (rt) {
+    LIONET_ERROR(g_logger) << "pthread_setaffinity_np fail, rt=" << rt
+                           << " name=" << t_thread_name;
+    return false;
+  }
+  return true;
+}
+
+std::vector<int> Thread::GetAffinity() {
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0) {
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &set)) {
+        cpus.push_back(i);
+      }
+    }
+  }
+  return cpus;
+}
+
+Thread::Thread(std::function<void()> func, const std::string& name,
+               const std::vector<int>& cpus)
+    : m_func(func), m_name(name), m_cpus(cpus) {
   if (name.empty()) {
     m_name = "UNKNOW";
   }
@@ -68,6 +108,9 @@ void* Thread::run(void* arg) {
   t_thread_name = thread->m_name;
   thread->m_id = LioNet::GetThreadId();
   pthread_setname_np(pthread_self(), thread->m_name.substr(0, 15).c_str());
+  if (!thread->m_cpus.empty()) {
+    SetAffinity(thread->m_cpus);
+  }
 
   std::function<void()> task;
   // 使用 swap 的主要目的是为了高效地转移任务函数的所有权，避免不必要的引用计数开销，并确保任务函数只被执行一次。
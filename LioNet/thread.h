@@ -10,6 +10,7 @@
 #include <list>
 #include <memory>
 #include <string>
+#include <vector>
 #include "mutex.h"
 
 namespace LioNet {
@@ -25,8 +26,10 @@ class Thread : Noncopyable {
    * @brief 构造函数
    * @param[in] func func 线程执行函数
    * @param[in] name 线程名称
+   * @param[in] cpus 线程可以运行的 CPU，空表示不限制；线程开始执行 func 之前设置
    */
-  Thread(std::function<void()> func, const std::string& name);
+  Thread(std::function<void()> func, const std::string& name,
+         const std::vector<int>& cpus = std::vector<int>());
 
   /**
    * @brief 析构函数
@@ -43,6 +46,11 @@ class Thread : Noncopyable {
    */
   const std::string& getName() const { return m_name; }
 
+  /**
+   * @brief 构造时指定的 CPU 集合，空表示不限制
+   */
+  const std::vector<int>& getCpus() const { return m_cpus; }
+
   /**
    * @brief 等待线程执行完成
    */
@@ -64,6 +72,18 @@ class Thread : Noncopyable {
    */
   static void SetName(const std::string& name);
 
+  /**
+   * @brief 设置当前线程可以运行的 CPU
+   * @param[in] cpus CPU 编号，空表示进程可用的所有 CPU
+   * @return 成功返回 true
+   */
+  static bool SetAffinity(const std::vector<int>& cpus);
+
+  /**
+   * @brief 返回当前线程可以运行的 CPU
+   */
+  static std::vector<int> GetAffinity();
+
  private:
   /**
    * @brief 线程执行函数
@@ -75,6 +95,7 @@ class Thread : Noncopyable {
   pthread_t m_thread = 0;        // 线程结构
   std::function<void()> m_func;  // 线程执行函数
   std::string m_name;            // 线程名称
+  std::vector<int> m_cpus;       // 绑定的 CPU，空表示不限制
   Semaphore m_semaphore;         // 信号量，同步线程的启动过程
 };
 
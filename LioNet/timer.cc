@@ -0,0 +1,367 @@
+#include "timer.h"
+#include <string.h>
+#include <algorithm>
+#include "util.h"
+
+namespace LioNet {
+
+// 不在时间轮上
+static const uint16_t kNoSlot = 0xFFFF;
+
+const int TimerManager::kRootBits;
+const int TimerManager::kLevelBits;
+const int TimerManager::kLevels;
+const size_t TimerManager::kRootSlots;
+const size_t TimerManager::kLevelSlots;
+const size_t TimerManager::kSlots;
+
+/**
+ * @brief 在 bits 位的位图中从 from 开始循环查找第一个置位
+ * @return 与 from 的距离，没有返回 -1
+ */
+static int FindNext(const uint64_t* map, size_t bits, size_t from) {
+  for (size_t k = 0; k < bits;) {
+    size_t i = (from + k) % bits;
+    uint64_t word = map[i / 64] >> (i % 64);
+    if (word) {
+      return static_cast<int>(k + __builtin_ctzll(word));
+    }
+    k += 64 - i % 64;
+  }
+  return -1;
+}
+
+Timer::Timer(uint64_t ms, std::function<void()> cb, bool recurring,
+             TimerManager* manager)
+    : m_slot(kNoSlot),
+      m_recurring(recurring),
+      m_ms(ms),
+      m_manager(manager),
+      m_cb(std::move(cb)) {}
+
+bool Timer::cancel() {
+  // 回调在解锁后析构，其中的对象可以再操作定时器
+  std::function<void()> cb;
+  {
+    TimerManager::MutexType::Lock lock(m_manager->m_mutex);
+    if (m_slot == kNoSlot) {
+      return false;
+    }
+    m_manager->unlink(this);
+    cb.swap(m_cb);
+  }
+  // 调用方持有引用，这里只释放时间轮的引用
+  unref();
+  return true;
+}
+
+bool Timer::refresh() {
+  TimerManager::MutexType::Lock lock(m_manager->m_mutex);
+  if (m_slot == kNoSlot) {
+    return false;
+  }
+  m_manager->unlink(this);
+  m_expire = GetMonotonicMS() + m_ms;
+  m_manager->link(this);
+  return true;
+}
+
+bool Timer::reset(uint64_t ms, bool from_now) {
+  bool at_front = false;
+  {
+    TimerManager::MutexType::Lock lock(m_manager->m_mutex);
+    if (m_slot == kNoSlot) {
+      return false;
+    }
+    if (ms == m_ms && !from_now) {
+      return true;
+    }
+    m_manager->unlink(this);
+    uint64_t start = from_now ? GetMonotonicMS() : m_expire - m_ms;
+    m_ms = ms;
+    m_expire = start + m_ms;
+    at_front = m_manager->insert(this);
+  }
+  if (at_front) {
+    m_manager->onTimerInsertedAtFront();
+  }
+  return true;
+}
+
+TimerManager::TimerManager() : m_current(GetMonotonicMS()) {
+  memset(m_slots, 0, sizeof(m_slots));
+  memset(m_bitmap, 0, sizeof(m_bitmap));
+}
+
+TimerManager::~TimerManager() {
+  for (size_t i = 0; i < kSlots; ++i) {
+    Timer* timer = m_slots[i];
+    while (timer) {
+      Timer* next = timer->m_next;
+      timer->m_slot = kNoSlot;
+      timer->m_prev = timer->m_next = nullptr;
+      timer->unref();
+      timer = next;
+    }
+  }
+}
+
+Timer::ptr TimerManager::addTimer(uint64_t ms, std::function<void()> cb,
+                                  bool recurring) {
+  Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+  bool at_front = false;
+  {
+    MutexType::Lock lock(m_mutex);
+    timer->m_expire = GetMonotonicMS() + ms;
+    // 时间轮持有一个引用，触发（一次性）或取消时释放
+    timer->ref();
+    at_front = insert(timer.get());
+  }
+  if (at_front) {
+    onTimerInsertedAtFront();
+  }
+  return timer;
+}
+
+Timer::ptr TimerManager::addConditionTimer(uint64_t ms,
+                                           std::function<void()> cb,
+                                           std::weak_ptr<void> weak_cond,
+                                           bool recurring) {
+  Timer::ptr timer(new Timer(ms, std::move(cb), recurring, this));
+  timer->m_conditional = true;
+  timer->m_cond = std::move(weak_cond);
+  bool at_front = false;
+  {
+    MutexType::Lock lock(m_mutex);
+    timer->m_expire = GetMonotonicMS() + ms;
+    // 时间轮持有一个引用，触发（一次性）或取消时释放
+    timer->ref();
+    at_front = insert(timer.get());
+  }
+  if (at_front) {
+    onTimerInsertedAtFront();
+  }
+  return timer;
+}
+
+size_t TimerManager::clearTimers() {
+  // 回调和时间轮的引用在解锁后释放，其中的对象可以再操作定时器
+  std::vector<std::function<void()> > cbs;
+  std::vector<Timer::ptr> released;
+  MutexType::Lock lock(m_mutex);
+  for (size_t i = 0; i < kSlots; ++i) {
+    Timer* timer = m_slots[i];
+    while (timer) {
+      Timer* next = timer->m_next;
+      timer->m_slot = kNoSlot;
+      timer->m_prev = timer->m_next = nullptr;
+      cbs.push_back(std::move(timer->m_cb));
+      timer->m_cb = nullptr;
+      released.push_back(Timer::ptr(timer));
+      timer->unref();
+      timer = next;
+    }
+  }
+  memset(m_slots, 0, sizeof(m_slots));
+  memset(m_bitmap, 0, sizeof(m_bitmap));
+  m_count.store(0, std::memory_order_relaxed);
+  m_oneShotCount.store(0, std::memory_order_relaxed);
+  m_nextExpire.store(UINT64_MAX, std::memory_order_relaxed);
+  lock.unlock();
+  return released.size();
+}
+
+bool TimerManager::insert(Timer* timer) {
+  link(timer);
+  // 已经过期的在下一次推进的时刻触发
+  uint64_t expire = std::max(timer->m_expire, m_current);
+  if (expire < m_nextExpire.load(std::memory_order_relaxed)) {
+    m_nextExpire.store(expire, std::memory_order_relaxed);
+    return true;
+  }
+  return false;
+}
+
+void TimerManager::link(Timer* timer) {
+  // 已经过期的放在当前槽，下一次推进时触发
+  uint64_t expire = std::max(timer->m_expire, m_current);
+  uint64_t delta = expire - m_current;
+  size_t slot;
+  if (delta < kRootSlots) {
+    slot = expire & (kRootSlots - 1);
+  } else {
+    int level = 1;
+    while (level < kLevels &&
+           delta >> (kRootBits + level * kLevelBits) != 0) {
+      ++level;
+    }
+    if (delta >> (kRootBits + kLevels * kLevelBits) != 0) {
+      // 超出时间轮范围，先放在最高层最远的槽
+      expire = m_current + (1ull << (kRootBits + kLevels * kLevelBits)) - 1;
+    }
+    int shift = kRootBits + (level - 1) * kLevelBits;
+    slot = kRootSlots + (level - 1) * kLevelSlots +
+           ((expire >> shift) & (kLevelSlots - 1));
+  }
+
+  Timer*& head = m_slots[slot];
+  timer->m_prev = nullptr;
+  timer->m_next = head;
+  if (head) {
+    head->m_prev = timer;
+  }
+  head = timer;
+  timer->m_slot = static_cast<uint16_t>(slot);
+  m_bitmap[slot / 64] |= 1ull << (slot % 64);
+  m_count.fetch_add(1, std::memory_order_relaxed);
+  if (!timer->m_recurring) {
+    m_oneShotCount.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+void TimerManager::unlink(Timer* timer) {
+  size_t slot = timer->m_slot;
+  if (timer->m_prev) {
+    timer->m_prev->m_next = timer->m_next;
+  } else {
+    m_slots[slot] = timer->m_next;
+  }
+  if (timer->m_next) {
+    timer->m_next->m_prev = timer->m_prev;
+  }
+  if (!m_slots[slot]) {
+    m_bitmap[slot / 64] &= ~(1ull << (slot % 64));
+  }
+  timer->m_prev = timer->m_next = nullptr;
+  timer->m_slot = kNoSlot;
+  m_count.fetch_sub(1, std::memory_order_relaxed);
+  if (!timer->m_recurring) {
+    m_oneShotCount.fetch_sub(1, std::memory_order_relaxed);
+  }
+}
+
+size_t TimerManager::cascade(int level) {
+  int shift = kRootBits + (level - 1) * kLevelBits;
+  size_t index = (m_current >> shift) & (kLevelSlots - 1);
+  size_t slot = kRootSlots + (level - 1) * kLevelSlots + index;
+  Timer* timer = m_slots[slot];
+  m_slots[slot] = nullptr;
+  m_bitmap[slot / 64] &= ~(1ull << (slot % 64));
+  // 重新放入时计数，最后再减去，无锁读取的计数不会短暂地偏小
+  size_t moved = 0;
+  size_t one_shot = 0;
+  while (timer) {
+    Timer* next = timer->m_next;
+    link(timer);
+    ++moved;
+    one_shot += timer->m_recurring ? 0 : 1;
+    timer = next;
+  }
+  m_count.fetch_sub(moved, std::memory_order_relaxed);
+  m_oneShotCount.fetch_sub(one_shot, std::memory_order_relaxed);
+  return index;
+}
+
+uint64_t TimerManager::computeNextExpire() const {
+  if (m_count.load(std::memory_order_relaxed) == 0) {
+    return UINT64_MAX;
+  }
+  uint64_t next = UINT64_MAX;
+  // 第 0 层的槽内到期时间相同，第一个非空槽就是精确值
+  int k = FindNext(m_bitmap, kRootSlots, m_current & (kRootSlots - 1));
+  if (k >= 0) {
+    next = m_current + k;
+  }
+  // 上层取第一个非空槽级联的时间；当前槽在本圈已经级联过时属于下一圈
+  for (int level = 1; level <= kLevels; ++level) {
+    int shift = kRootBits + (level - 1) * kLevelBits;
+    uint64_t pos = m_current >> shift;
+    size_t first = kRootSlots + (level - 1) * kLevelSlots;
+    uint64_t word = m_bitmap[first / 64];
+    if (word == 0) {
+      continue;
+    }
+    size_t index = pos & (kLevelSlots - 1);
+    // 每层 64 个槽正好一个字，循环右移后第 k 位对应 index + k
+    uint64_t rotated = index ? (word >> index) | (word << (64 - index)) : word;
+    uint64_t steps;
+    if ((rotated & 1) && (m_current & ((1ull << shift) - 1)) == 0) {
+      steps = 0;
+    } else if (rotated >> 1) {
+      steps = __builtin_ctzll(rotated >> 1) + 1;
+    } else {
+      steps = kLevelSlots;
+    }
+    next = std::min(next, (pos + steps) << shift);
+  }
+  return next;
+}
+
+uint64_t TimerManager::getNextTimer() const {
+  uint64_t next = m_nextExpire.load(std::memory_order_relaxed);
+  if (next == UINT64_MAX) {
+    return ~0ull;
+  }
+  uint64_t now = GetMonotonicMS();
+  return next > now ? next - now : 0;
+}
+
+void TimerManager::listExpiredCbs(std::vector<std::function<void()> >& cbs) {
+  uint64_t now = GetMonotonicMS();
+  if (now < m_nextExpire.load(std::memory_order_relaxed)) {
+    return;
+  }
+  // 时间轮的引用在解锁后释放，回调和条件的析构不在锁内
+  std::vector<Timer::ptr> released;
+  MutexType::Lock lock(m_mutex);
+  while (m_current <= now) {
+    if (m_count.load(std::memory_order_relaxed) == 0) {
+      m_current = now + 1;
+      break;
+    }
+    size_t index = m_current & (kRootSlots - 1);
+    if (index == 0) {
+      for (int level = 1; level <= kLevels && cascade(level) == 0; ++level) {
+      }
+    }
+    Timer* timer = m_slots[index];
+    m_slots[index] = nullptr;
+    m_bitmap[index / 64] &= ~(1ull << (index % 64));
+    while (timer) {
+      Timer* next = timer->m_next;
+      timer->m_prev = timer->m_next = nullptr;
+      timer->m_slot = kNoSlot;
+      if (!timer->m_recurring) {
+        m_oneShotCount.fetch_sub(1, std::memory_order_relaxed);
+      }
+      if (timer->m_conditional && timer->m_cond.expired()) {
+        released.push_back(Timer::ptr(timer));
+        timer->unref();
+      } else if (timer->m_recurring) {
+        cbs.push_back(timer->m_cb);
+        // 周期为 0 时也放到下一毫秒，不在本次推进中重复触发
+        timer->m_expire = now + std::max<uint64_t>(timer->m_ms, 1);
+        link(timer);
+      } else {
+        cbs.push_back(std::move(timer->m_cb));
+        timer->m_cb = nullptr;
+        released.push_back(Timer::ptr(timer));
+        timer->unref();
+      }
+      // 循环定时器重新放入后再减去，总数不会短暂地为 0
+      m_count.fetch_sub(1, std::memory_order_relaxed);
+      timer = next;
+    }
+    // 跳过空槽，直接到下一个非空槽或下一次级联
+    int k = FindNext(m_bitmap, kRootSlots, (index + 1) % kRootSlots);
+    uint64_t step = kRootSlots - index;
+    if (k >= 0 && static_cast<uint64_t>(k) + 1 < step) {
+      step = k + 1;
+    }
+    m_current = std::min(m_current + step, now + 1);
+  }
+  m_nextExpire.store(computeNextExpire(), std::memory_order_relaxed);
+  lock.unlock();
+}
+
+}  // namespace LioNet
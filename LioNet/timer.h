@@ -0,0 +1,214 @@
+/**
+ * @file timer.h
+ * @brief 分层时间轮定时器
+ */
+
+#ifndef __LIONET_TIMER_H__
+#define __LIONET_TIMER_H__
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "intrusive_ptr.h"
+#include "mutex.h"
+
+namespace LioNet {
+
+class TimerManager;
+
+/**
+ * @brief 定时器
+ * @details 由 TimerManager 创建。定时器挂在时间轮槽的侵入式双向链表上，
+ *          插入、取消都是 O(1)，每个定时器只占一次内存分配
+ */
+class Timer : public RefCounted<Timer> {
+  friend class TimerManager;
+
+ public:
+  typedef IntrusivePtr<Timer> ptr;
+
+  /**
+   * @brief 取消定时器
+   * @return 已经触发（一次性定时器）或已经取消返回 false
+   */
+  bool cancel();
+
+  /**
+   * @brief 从现在起重新计时，周期不变
+   */
+  bool refresh();
+
+  /**
+   * @brief 重新设置定时器的周期
+   * @param[in] ms 新的周期（毫秒）
+   * @param[in] from_now 是否从现在开始计时，否则从上一次开始计时的时间算起
+   */
+  bool reset(uint64_t ms, bool from_now);
+
+ private:
+  /**
+   * @brief 构造函数
+   * @param[in] ms 周期（毫秒）
+   * @param[in] cb 回调
+   * @param[in] recurring 是否循环
+   * @param[in] manager 所属的定时器管理器
+   */
+  Timer(uint64_t ms, std::function<void()> cb, bool recurring,
+        TimerManager* manager);
+
+ private:
+  uint16_t m_slot;           // 所在的时间轮槽，不在时间轮上为 kNoSlot
+  bool m_recurring;          // 是否循环
+  bool m_conditional = false;  // 是否为条件定时器
+  Timer* m_prev = nullptr;   // 槽内链表
+  Timer* m_next = nullptr;
+  uint64_t m_expire = 0;     // 到期时间（单调时钟毫秒）
+  uint64_t m_ms;             // 周期（毫秒）
+  TimerManager* m_manager;   // 所属的定时器管理器
+  std::function<void()> m_cb;  // 回调
+  std::weak_ptr<void> m_cond;  // 条件，失效后定时器在到期时取消
+};
+
+/**
+ * @brief 定时器管理器
+ * @details 毫秒精度的分层时间轮：第 0 层 256 个槽，每槽 1 毫秒；其上 4 层各 64 个槽，
+ *          每层的槽宽是下一层一整圈，覆盖约 49 天，更远的定时器先放在最高层，
+ *          到时重新放置。下层转满一圈时把上一层当前槽的定时器重新放入下层（级联）。
+ *          插入和取消 O(1)；推进时间只处理非空的槽。
+ *          下一个到期时间在第 0 层是精确值，在上层取最近一次非空槽级联的时间，
+ *          不晚于其中任何定时器的到期时间
+ */
+class TimerManager {
+  friend class Timer;
+
+ public:
+  typedef Mutex MutexType;
+
+  /**
+   * @brief 构造函数
+   */
+  TimerManager();
+
+  /**
+   * @brief 析构函数，未触发的定时器不再触发
+   */
+  virtual ~TimerManager();
+
+  /**
+   * @brief 添加定时器
+   * @param[in] ms 定时器执行间隔时间（毫秒）
+   * @param[in] cb 定时器回调函数
+   * @param[in] recurring 是否循环定时器
+   */
+  Timer::ptr addTimer(uint64_t ms, std::function<void()> cb,
+                      bool recurring = false);
+
+  /**
+   * @brief 添加条件定时器
+   * @param[in] ms 定时器执行间隔时间（毫秒）
+   * @param[in] cb 定时器回调函数
+   * @param[in] weak_cond 条件，到期时已经失效则定时器被取消，不执行回调
+   * @param[in] recurring 是否循环定时器
+   */
+  Timer::ptr addConditionTimer(uint64_t ms, std::function<void()> cb,
+                               std::weak_ptr<void> weak_cond,
+                               bool recurring = false);
+
+  /**
+   * @brief 返回到下一个定时器到期的毫秒数（不晚于实际到期），已到期返回 0，
+   *        没有定时器返回 ~0ull
+   */
+  uint64_t getNextTimer() const;
+
+  /**
+   * @brief 推进时间轮，取出已经到期的定时器回调
+   * @param[out] cbs 到期的回调，循环定时器重新计时
+   */
+  void listExpiredCbs(std::vector<std::function<void()> >& cbs);
+
+  /**
+   * @brief 丢弃所有定时器，不执行回调
+   * @details 释放时间轮持有的引用，调用方持有的 Timer 之后 cancel() 返回 false
+   * @return 丢弃的定时器数量
+   */
+  size_t clearTimers();
+
+  /**
+   * @brief 是否有定时器
+   */
+  bool hasTimer() const {
+    return m_count.load(std::memory_order_relaxed) > 0;
+  }
+
+  /**
+   * @brief 是否有一次性定时器，循环定时器不计在内
+   */
+  bool hasOneShotTimer() const {
+    return m_oneShotCount.load(std::memory_order_relaxed) > 0;
+  }
+
+  /**
+   * @brief 返回定时器数量
+   */
+  size_t getTimerCount() const {
+    return m_count.load(std::memory_order_relaxed);
+  }
+
+ protected:
+  /**
+   * @brief 新加入的定时器比之前所有的都早到期时调用（不持有锁）
+   */
+  virtual void onTimerInsertedAtFront() {}
+
+ private:
+  /**
+   * @brief 放入时间轮并更新下一个到期时间（需持有 m_mutex）
+   * @return 是否比之前所有的定时器都早到期
+   */
+  bool insert(Timer* timer);
+
+  /**
+   * @brief 按到期时间挂到对应的槽上（需持有 m_mutex）
+   */
+  void link(Timer* timer);
+
+  /**
+   * @brief 从所在的槽上摘下（需持有 m_mutex）
+   */
+  void unlink(Timer* timer);
+
+  /**
+   * @brief 把第 level 层当前槽的定时器重新放入下层（需持有 m_mutex）
+   * @return 当前槽的序号，为 0 时上一层也要级联
+   */
+  size_t cascade(int level);
+
+  /**
+   * @brief 计算下一个到期时间的下界（需持有 m_mutex）
+   */
+  uint64_t computeNextExpire() const;
+
+ private:
+  static const int kRootBits = 8;
+  static const int kLevelBits = 6;
+  static const int kLevels = 4;  // 第 0 层之上的层数
+  static const size_t kRootSlots = 1 << kRootBits;
+  static const size_t kLevelSlots = 1 << kLevelBits;
+  static const size_t kSlots = kRootSlots + kLevels * kLevelSlots;
+
+  mutable MutexType m_mutex;
+  Timer* m_slots[kSlots];             // 各槽链表头，按层依次排列
+  uint64_t m_bitmap[kSlots / 64];     // 非空槽的位图
+  uint64_t m_current;                 // 下一个要处理的时刻（单调时钟毫秒）
+  std::atomic<size_t> m_count{0};     // 定时器数量
+  std::atomic<size_t> m_oneShotCount{0};  // 一次性定时器数量
+  // 下一个到期时间的下界，没有定时器为 UINT64_MAX；无锁判断是否需要推进
+  std::atomic<uint64_t> m_nextExpire{UINT64_MAX};
+};
+
+}  // namespace LioNet
+
+#endif
@@ -7,8 +7,12 @@
 #include <sys/syscall.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <time.h>
 #include <unistd.h>
+#include <atomic>
 #include <fstream>
+#include <unordered_map>
+#include "config.h"
 #include "fiber.h"
 
 #include "log.h"
@@ -38,38 +42,169 @@ static std::string demangle(const char* str) {
     }
   }
   if (1 == sscanf(str, "%255s", &rt[0])) {
+    rt.resize(strlen(rt.c_str()));
     return rt;
   }
   return str;
 }
 
-void Backtrace(std::vector<std::string>& bt, int size, int skip) {
-  void** array = (void**)malloc(sizeof(void*) * size);
-  size_t s = ::backtrace(array, size);
+static ConfigVar<uint32_t>::ptr g_backtrace_rate_limit =
+    Config::Lookup<uint32_t>("backtrace.rate_limit_ms", 1000,
+                             "min interval to print an identical backtrace");
+
+static std::atomic<uint32_t> s_backtrace_rate_limit{1000};
+
+struct BacktraceIniter {
+  BacktraceIniter() {
+    s_backtrace_rate_limit = g_backtrace_rate_limit->getValue();
+    g_backtrace_rate_limit->addListener(
+        [](const uint32_t&, const uint32_t& new_value) {
+          s_backtrace_rate_limit = new_value;
+        });
+  }
+};
+
+static BacktraceIniter __backtrace_init;
+
+// 符号化结果按返回地址缓存，超过上限时整体清空
+static const size_t kMaxCachedSymbols = 16384;
+
+static RWMutex& GetSymbolMutex() {
+  static RWMutex s_mutex;
+  return s_mutex;
+}
+
+static std::unordered_map<void*, std::string>& GetSymbolCache() {
+  static std::unordered_map<void*, std::string> s_cache;
+  return s_cache;
+}
+
+static std::string Symbolize(void* addr) {
+  {
+    RWMutex::ReadLock lock(GetSymbolMutex());
+    auto it = GetSymbolCache().find(addr);
+    if (it != GetSymbolCache().end()) {
+      return it->second;
+    }
+  }
 
-  char** strings = backtrace_symbols(array, size);
-  if (strings == NULL) {
-    LIONET_ERROR(g_logger) << "backtrace_synbols error";
-    free(array);
+  std::string name;
+  char** strings = backtrace_symbols(&addr, 1);
+  if (strings) {
+    name = demangle(strings[0]);
     free(strings);
-    return;
+  } else {
+    std::stringstream ss;
+    ss << addr;
+    name = ss.str();
   }
 
-  for (size_t i = skip; i < s; ++i) {
-    bt.push_back(demangle(strings[i]));
+  RWMutex::WriteLock lock(GetSymbolMutex());
+  auto& cache = GetSymbolCache();
+  if (cache.size() >= kMaxCachedSymbols) {
+    cache.clear();
+  }
+  cache[addr] = name;
+  return name;
+}
+
+StackTrace::StackTrace(int size, int skip, const char* prefix)
+    : m_prefix(prefix) {
+  if (size > kMaxFrames) {
+    size = kMaxFrames;
   }
+  m_size = ::backtrace(m_frames, size);
+  if (skip > m_size) {
+    skip = m_size;
+  }
+  if (skip > 0) {
+    memmove(m_frames, m_frames + skip, sizeof(void*) * (m_size - skip));
+    m_size -= skip;
+  }
+}
 
-  free(array);
-  free(strings);
+uint64_t StackTrace::hash() const {
+  // FNV-1a
+  uint64_t h = 14695981039346656037ull;
+  for (int i = 0; i < m_size; ++i) {
+    h ^= (uint64_t)m_frames[i];
+    h *= 1099511628211ull;
+  }
+  return h;
+}
+
+std::ostream& StackTrace::dump(std::ostream& os) const {
+  for (int i = 0; i < m_size; ++i) {
+    os << m_prefix << Symbolize(m_frames[i]) << std::endl;
+  }
+  return os;
+}
+
+namespace {
+/**
+ * @brief 最近输出过的调用栈，按哈希分槽
+ */
+struct BacktraceRecord {
+  uint64_t hash = 0;
+  uint64_t last_ms = 0;
+  uint64_t suppressed = 0;
+};
+}  // namespace
+
+static const size_t kBacktraceRecords = 64;
+
+std::ostream& StackTrace::dumpLimited(std::ostream& os) const {
+  uint32_t interval = s_backtrace_rate_limit.load(std::memory_order_relaxed);
+  if (interval == 0) {
+    return dump(os);
+  }
+
+  static Mutex s_mutex;
+  static BacktraceRecord s_records[kBacktraceRecords];
+  uint64_t h = hash();
+  uint64_t now = GetCurrentMS();
+  uint64_t suppressed = 0;
+  bool repeated = false;
+  {
+    Mutex::Lock lock(s_mutex);
+    BacktraceRecord& r = s_records[h % kBacktraceRecords];
+    if (r.hash == h && now - r.last_ms < interval) {
+      repeated = true;
+      suppressed = ++r.suppressed;
+    } else {
+      suppressed = r.hash == h ? r.suppressed : 0;
+      r.hash = h;
+      r.last_ms = now;
+      r.suppressed = 0;
+    }
+  }
+
+  if (repeated) {
+    return os << m_prefix << "<backtrace " << std::hex << h << std::dec
+              << " repeated, " << suppressed << " suppressed>" << std::endl;
+  }
+  if (suppressed) {
+    os << m_prefix << "(" << suppressed << " identical backtraces suppressed)"
+       << std::endl;
+  }
+  return dump(os);
+}
+
+std::ostream& operator<<(std::ostream& os, const StackTrace& st) {
+  return st.dumpLimited(os);
+}
+
+void Backtrace(std::vector<std::string>& bt, int size, int skip) {
+  StackTrace st(size, skip + 1);
+  for (int i = 0; i < st.size(); ++i) {
+    bt.push_back(Symbolize(st.frame(i)));
+  }
 }
 
 std::string BacktraceToString(int size, int skip, const std::string& prefix) {
-  std::vector<std::string> bt;
-  Backtrace(bt, size, skip);
+  StackTrace st(size, skip, prefix.c_str());
   std::stringstream ss;
-  for (size_t i = 0; i < bt.size(); ++i) {
-    ss << prefix << bt[i] << std::endl;
-  }
+  st.dump(ss);
   return ss.str();
 }
 
@@ -85,6 +220,18 @@ uint64_t GetCurrentUS() {
   return tv.tv_sec * 1000ul * 1000ul + tv.tv_usec;
 }
 
+uint64_t GetMonotonicMS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ul + ts.tv_nsec / 1000000;
+}
+
+uint64_t GetMonotonicUS() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000ul * 1000ul + ts.tv_nsec / 1000;
+}
+
 void FSUtil::ListAllFile(std::vector<std::string>& files,
                          const std::string& path, const std::string& subfix) {
   if (access(path.c_str(), 0) != 0) {
@@ -42,6 +42,61 @@ void Backtrace(std::vector<std::string>& bt, int size = 64, int skip = 1);
 std::string BacktraceToString(int size = 64, int skip = 1,
                               const std::string& prefix = "");
 
+/**
+ * @brief 原始调用栈
+ * @details 构造时只用 backtrace() 记录返回地址，不做符号化。
+ *          输出到流时才逐帧符号化，结果按地址缓存；
+ *          同一调用栈在配置 backtrace.rate_limit_ms 时间内重复输出时只打印一行摘要
+ */
+class StackTrace {
+ public:
+  static const int kMaxFrames = 128;
+
+  /**
+   * @brief 捕获当前调用栈
+   * @param[in] size 最多记录的层数
+   * @param[in] skip 跳过栈顶的层数
+   * @param[in] prefix 输出时每行的前缀，需要在输出前保持有效
+   */
+  explicit StackTrace(int size = 64, int skip = 1, const char* prefix = "");
+
+  /**
+   * @brief 返回记录的层数
+   */
+  int size() const { return m_size; }
+
+  /**
+   * @brief 返回第 i 层的返回地址
+   */
+  void* frame(int i) const { return m_frames[i]; }
+
+  /**
+   * @brief 返回调用栈的哈希值，相同调用栈的哈希相同
+   */
+  uint64_t hash() const;
+
+  /**
+   * @brief 符号化输出完整调用栈（不做频率限制）
+   */
+  std::ostream& dump(std::ostream& os) const;
+
+  /**
+   * @brief 按频率限制输出：重复的调用栈只输出摘要
+   */
+  std::ostream& dumpLimited(std::ostream& os) const;
+
+ private:
+  void* m_frames[kMaxFrames];
+  int m_size = 0;
+  const char* m_prefix;
+};
+
+/**
+ * @brief 输出调用栈，受 backtrace.rate_limit_ms 频率限制
+ * @details 输出时立即符号化；写日志用 LIONET_LOG_STACK，推迟到格式化时
+ */
+std::ostream& operator<<(std::ostream& os, const StackTrace& st);
+
 /**
  * @brief 获取当前时间的毫秒
  */
@@ -52,6 +107,16 @@ uint64_t GetCurrentMS();
  */
 uint64_t GetCurrentUS();
 
+/**
+ * @brief 获取单调时钟的毫秒，不受系统时间调整影响，用于定时器
+ */
+uint64_t GetMonotonicMS();
+
+/**
+ * @brief 获取单调时钟的微秒，不受系统时间调整影响
+ */
+uint64_t GetMonotonicUS();
+
 class FSUtil {
  public:
   static void ListAllFile(std::vector<std::string>& files,
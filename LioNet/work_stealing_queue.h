@@ -0,0 +1,164 @@
+/**
+ * @file work_stealing_queue.h
+ * @brief Chase-Lev 工作窃取双端队列
+ */
+
+#ifndef __LIONET_WORK_STEALING_QUEUE_H__
+#define __LIONET_WORK_STEALING_QUEUE_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+
+#include "noncopyable.h"
+
+namespace LioNet {
+
+/**
+ * @brief 无锁工作窃取队列（Chase-Lev，C11 内存模型版本）
+ * @details 只有所有者线程可以 push/pop，在底部操作；任意线程可以 steal，从顶部取。
+ *          底部 pop 为 LIFO，顶部 steal 为 FIFO。
+ *          环形数组满时所有者把容量翻倍，旧数组可能仍在被窃取者读取，
+ *          保留到队列析构时释放。队列只保存指针，不管理元素生命周期。
+ */
+template <class T>
+class WorkStealingQueue : Noncopyable {
+ public:
+  /**
+   * @brief 构造函数
+   * @param[in] capacity 初始容量，取整到 2 的幂
+   */
+  explicit WorkStealingQueue(size_t capacity = 256) {
+    size_t cap = 2;
+    while (cap < capacity) {
+      cap <<= 1;
+    }
+    m_array.store(new Array(cap), std::memory_order_relaxed);
+  }
+
+  ~WorkStealingQueue() {
+    delete m_array.load(std::memory_order_relaxed);
+    for (auto i : m_retired) {
+      delete i;
+    }
+  }
+
+  /**
+   * @brief 在底部压入元素（仅所有者线程）
+   */
+  void push(T* v) {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_acquire);
+    Array* a = m_array.load(std::memory_order_relaxed);
+    if (b - t > static_cast<int64_t>(a->mask)) {
+      a = grow(a, t, b);
+    }
+    a->put(b, v);
+    std::atomic_thread_fence(std::memory_order_release);
+    m_bottom.store(b + 1, std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief 从底部弹出最近压入的元素（仅所有者线程）
+   * @return 队列为空时返回 nullptr
+   */
+  T* pop() {
+    int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = m_array.load(std::memory_order_relaxed);
+    m_bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    if (t > b) {
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    T* v = a->get(b);
+    if (t == b) {
+      // 只剩最后一个元素，与窃取者竞争
+      if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed)) {
+        v = nullptr;
+      }
+      m_bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return v;
+  }
+
+  /**
+   * @brief 从顶部取走最早压入的元素（任意线程）
+   * @return 队列为空或与其他线程竞争失败时返回 nullptr
+   */
+  T* steal() {
+    int64_t t = m_top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = m_bottom.load(std::memory_order_acquire);
+    if (t >= b) {
+      return nullptr;
+    }
+    Array* a = m_array.load(std::memory_order_acquire);
+    T* v = a->get(t);
+    if (!m_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                       std::memory_order_relaxed)) {
+      return nullptr;
+    }
+    return v;
+  }
+
+  /**
+   * @brief 返回元素数量（并发修改时为近似值）
+   */
+  size_t size() const {
+    int64_t b = m_bottom.load(std::memory_order_relaxed);
+    int64_t t = m_top.load(std::memory_order_relaxed);
+    return b > t ? static_cast<size_t>(b - t) : 0;
+  }
+
+  /**
+   * @brief 是否为空（并发修改时为近似值）
+   */
+  bool empty() const { return size() == 0; }
+
+ private:
+  /**
+   * @brief 环形数组，下标对容量取模
+   */
+  struct Array {
+    explicit Array(size_t cap)
+        : mask(cap - 1), slots(new std::atomic<T*>[cap]) {}
+    ~Array() { delete[] slots; }
+
+    T* get(int64_t i) const {
+      return slots[i & mask].load(std::memory_order_relaxed);
+    }
+
+    void put(int64_t i, T* v) {
+      slots[i & mask].store(v, std::memory_order_relaxed);
+    }
+
+    size_t mask;
+    std::atomic<T*>* slots;
+  };
+
+  Array* grow(Array* a, int64_t t, int64_t b) {
+    Array* na = new Array((a->mask + 1) << 1);
+    for (int64_t i = t; i < b; ++i) {
+      na->put(i, a->get(i));
+    }
+    m_retired.push_back(a);
+    m_array.store(na, std::memory_order_release);
+    return na;
+  }
+
+ private:
+  // top 与 bottom 分属窃取者和所有者，隔开到不同缓存行上
+  std::atomic<int64_t> m_top{0};
+  char m_pad[64 - sizeof(std::atomic<int64_t>)];
+  std::atomic<int64_t> m_bottom{0};
+  std::atomic<Array*> m_array{nullptr};
+  std::vector<Array*> m_retired;  // 扩容替换下来的数组，只由所有者访问
+};
+
+}  // namespace LioNet
+
+#endif